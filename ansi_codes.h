@@ -5,11 +5,30 @@
 #define CLEAR_LINE "\x1b[2K"
 #define CURSOR_LEFT "\x1b[D"
 #define CURSOR_RIGHT "\x1b[C"
+#define CURSOR_LEFT_N "\x1b[%dD"
+#define CURSOR_RIGHT_N "\x1b[%dC"
+#define CLEAR_TO_EOL "\x1b[K"
+#define CLEAR_BELOW "\x1b[J"
+#define CURSOR_UP_N "\x1b[%dA"
+#define SAVE_CURSOR "\x1b" "7"
+#define RESTORE_CURSOR "\x1b" "8"
+#define INSERT_CHARS "\x1b[%d@"
+#define DELETE_CHARS "\x1b[%dP"
+
+#define BRACKETED_PASTE_ON "\x1b[?2004h"
+#define BRACKETED_PASTE_OFF "\x1b[?2004l"
+#define PASTE_END "\x1b[201~"
 
 #define GREEN "\x1b[32m"
 #define RED "\x1b[31m"
+#define YELLOW "\x1b[33m"
 #define BLUE "\x1b[34m"
+#define MAGENTA "\x1b[35m"
+#define CYAN "\x1b[36m"
 #define COLOR_RESET "\x1b[0m"
+#define REVERSE "\x1b[7m"
+#define DIM "\x1b[2m"
+#define BOLD "\x1b[1m"
 
 
 #endif
@@ -0,0 +1,180 @@
+#include "bash_worker.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Runs inside the worker. COMP_WORDS is split on whitespace only, like
+// the old one-shot script; a trailing space starts a new empty word.
+static const char *worker_script =
+    "source /usr/share/bash-completion/bash_completion 2>/dev/null\n"
+    "while IFS= read -r -d '' id && IFS= read -r -d '' cwd && IFS= read -r -d '' COMP_LINE"
+    " && IFS= read -r -d '' COMP_POINT; do\n"
+    "  cd -- \"$cwd\" 2>/dev/null\n"
+    "  COMP_TYPE=9 COMP_KEY=9 COMPREPLY=()\n"
+    "  line=${COMP_LINE:0:COMP_POINT}\n"
+    "  read -ra COMP_WORDS <<< \"$line\"\n"
+    "  [[ -z $line || $line == *[[:space:]] ]] && COMP_WORDS+=('')\n"
+    "  COMP_CWORD=$(( ${#COMP_WORDS[@]} - 1 ))\n"
+    "  cmd=${COMP_WORDS[0]} cur=${COMP_WORDS[COMP_CWORD]}\n"
+    "  if (( COMP_CWORD > 0 )); then\n"
+    "    complete -p -- \"$cmd\" &>/dev/null || _completion_loader \"$cmd\" &>/dev/null\n"
+    "    spec=$(complete -p -- \"$cmd\" 2>/dev/null)\n"
+    "    if [[ $spec =~ -F\\ ([^ ]+) ]]; then\n"
+    "      \"${BASH_REMATCH[1]}\" \"$cmd\" \"$cur\" \"${COMP_WORDS[COMP_CWORD-1]}\" </dev/null &>/dev/null\n"
+    "    fi\n"
+    "  fi\n"
+    "  (( ${#COMPREPLY[@]} )) || mapfile -t COMPREPLY < <(compgen -o default -- \"$cur\" 2>/dev/null)\n"
+    "  printf '%s\\0' \"$id\" \"${#COMPREPLY[@]}\" \"${COMPREPLY[@]}\"\n"
+    "done\n";
+
+static pid_t worker_pid = -1;
+static int worker_fd = -1;
+
+// The response being read for the request in flight. Bytes go straight
+// into its arena: the id and count arrive as its first two items.
+static struct {
+    bool busy;
+    CompletionList list;
+    long expected;  // Items, once the count is known
+} response;
+
+static void response_reset(void) {
+    response.busy = false;
+    free_completion_list(&response.list);
+    response.expected = -1;
+}
+
+void bash_worker_start(void) {
+    if (worker_pid > 0) return;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) return;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+
+    if (pid == 0) {
+        // Own process group, so terminal signals meant for jobs miss it
+        setpgid(0, 0);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(fds[1], STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        if (null_fd != -1) dup2(null_fd, STDERR_FILENO);
+        execlp("bash", "bash", "--noprofile", "--norc", "-c", worker_script, (char *)NULL);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    worker_pid = pid;
+    worker_fd = fds[0];
+}
+
+void bash_worker_stop(void) {
+    response_reset();
+    if (worker_pid <= 0) return;
+    close(worker_fd);
+    kill(worker_pid, SIGKILL);
+    waitpid(worker_pid, NULL, 0);
+    worker_pid = -1;
+    worker_fd = -1;
+}
+
+int bash_worker_fd(void) {
+    return worker_fd;
+}
+
+bool bash_worker_busy(void) {
+    return response.busy;
+}
+
+static bool send_all(const char *buf, size_t len) {
+    while (len > 0) {
+        // MSG_NOSIGNAL: a dead worker must not take the shell down with SIGPIPE
+        ssize_t n = send(worker_fd, buf, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool bash_worker_send(unsigned id, const char *cwd, const char *line, int point) {
+    if (response.busy) return false;
+
+    char header[32], point_str[16];
+    int header_len = snprintf(header, sizeof(header), "%u", id) + 1;
+    int point_len = snprintf(point_str, sizeof(point_str), "%d", point) + 1;
+    size_t cwd_len = strlen(cwd) + 1;
+    size_t line_len = strlen(line) + 1;
+
+    size_t request_len = header_len + cwd_len + line_len + point_len;
+    char *request = malloc(request_len);
+    if (!request) return false;
+    char *p = request;
+    memcpy(p, header, header_len);
+    memcpy(p += header_len, cwd, cwd_len);
+    memcpy(p += cwd_len, line, line_len);
+    memcpy(p += line_len, point_str, point_len);
+
+    // A worker that died since the last request gets one restart
+    bool sent = false;
+    for (int attempt = 0; attempt < 2 && !sent; attempt++) {
+        bash_worker_start();
+        if (worker_pid <= 0) break;
+        sent = send_all(request, request_len);
+        if (!sent) bash_worker_stop();
+    }
+    free(request);
+
+    if (sent) {
+        response_reset();
+        response.busy = true;
+    }
+    return sent;
+}
+
+// Read what is available without blocking. Returns true once the whole
+// response is in, handing its list to the empty *completions. If the
+// worker died, it is stopped and the request is lost.
+bool bash_worker_receive(unsigned *id, CompletionList *completions) {
+    if (worker_fd == -1) return false;
+
+    size_t room;
+    char *space = completion_list_space(&response.list, 4096, &room);
+    ssize_t n = recv(worker_fd, space, room, MSG_DONTWAIT);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR)) return false;
+    if (n <= 0) {
+        bash_worker_stop();
+        return false;
+    }
+    if (!response.busy) return false;  // Nothing was asked
+
+    completion_list_ingest(&response.list, n);
+    if (response.expected < 0 && response.list.count >= 2) {
+        response.expected = strtol(completion_item(&response.list, 1), NULL, 10);
+    }
+    if (response.expected < 0 || response.list.count < response.expected + 2) return false;
+
+    // Drop the id and count, keep the items where they are
+    *id = strtoul(completion_item(&response.list, 0), NULL, 10);
+    response.list.count -= 2;
+    memmove(response.list.items, response.list.items + 2,
+            response.list.count * sizeof(CompletionItem));
+    *completions = response.list;
+    memset(&response.list, 0, sizeof(response.list));
+    response_reset();
+    return true;
+}
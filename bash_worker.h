@@ -0,0 +1,24 @@
+#ifndef BASH_WORKER_H
+#define BASH_WORKER_H
+
+#include <stdbool.h>
+#include "completion.h"
+
+// One long-lived bash that has bash_completion loaded, answering
+// completion requests over a socket. Command-specific loaders it pulls
+// in stay defined for the next request. It works on one request at a
+// time; the caller polls bash_worker_fd() and collects the answer with
+// bash_worker_receive(). A worker that dies is started again by the
+// next bash_worker_send().
+//
+// Request:  id \0 cwd \0 line \0 point \0
+// Response: id \0 count \0 then count items, each \0-terminated
+
+void bash_worker_start(void);
+void bash_worker_stop(void);
+int bash_worker_fd(void);
+bool bash_worker_busy(void);
+bool bash_worker_send(unsigned id, const char *cwd, const char *line, int point);
+bool bash_worker_receive(unsigned *id, CompletionList *completions);
+
+#endif
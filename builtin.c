@@ -1,66 +1,761 @@
 #include "builtin.h"
 #include "ansi_codes.h"
+#include "command_cache.h"
+#include "completion_cache.h"
+#include "exec.h"
+#include "frame.h"
+#include "jobs.h"
+#include "line.h"
+#include "parser.h"
+#include "prompt.h"
+#include <errno.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-int is_builtin(const char *cmd) {
-    return strncmp(cmd, "cd ", 3) == 0
-        || strcmp(cmd, "cd") == 0
-        || strcmp(cmd, "colors") == 0;
+extern char **environ;
+
+typedef int (*BuiltinFunc)(int argc, char **argv);
+
+typedef struct {
+    const char *name;
+    BuiltinFunc run;
+} Builtin;
+
+// Performance counters, so startup and redraw costs can be tracked
+int stats(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    command_cache_print_stats();
+    completion_cache_print_stats();
+    exec_print_stats();
+    frame_print_stats();
+    return 0;
 }
 
-int handle_builtin(const char *cmd) {
-    if (strncmp(cmd, "cd", 2) == 0) {
-        return cd(cmd);
+int colors(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    printf("COLORS\n");
+    return 0;
+}
+
+// TODO PWD="~/xos" should work
+int cd(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : getenv("HOME");
+    if (!path) {
+        fprintf(stderr, "HOME not set\n");
+        return 1;
     }
 
-    if (strncmp(cmd, "colors", 6) == 0) {
-        return colors();
+    if (chdir(path) != 0) {
+        perror("cd");
+        return 1;
     }
+    prompt_invalidate();
+    return 0;
+}
+
+static int builtin_true(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    return 0;
+}
 
-    return 1; // Command not handled
+static int builtin_false(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    return 1;
 }
 
-int colors() {
-    printf("COLORS\n");
+static int builtin_pwd(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    char path[MAX_PATH];
+    if (!getcwd(path, sizeof(path))) {
+        perror("pwd");
+        return 1;
+    }
+    puts(path);
     return 0;
 }
 
-// TODO PWD="~/xos" should work
-int cd(const char *cmd) {
-    if (strcmp(cmd, "cd") == 0) {
-        const char *home = getenv("HOME");
-        if (!home) {
-            fprintf(stderr, "HOME not set\n");
+static bool is_octal(char c) {
+    return c >= '0' && c <= '7';
+}
+
+// Reads the escape whose letter is at p. Octal escapes are \0nnn for
+// echo and %b, \nnn in a printf format. Returns the byte, -1 for \c
+// (no more output) or -2 if there is no such escape; *end is set past
+// what was read.
+static int read_escape(const char *p, const char **end, bool zero_octal) {
+    *end = p + 1;
+    switch (*p) {
+    case 'a': return '\a';
+    case 'b': return '\b';
+    case 'c': return -1;
+    case 'e':
+    case 'E': return '\033';
+    case 'f': return '\f';
+    case 'n': return '\n';
+    case 'r': return '\r';
+    case 't': return '\t';
+    case 'v': return '\v';
+    case '\\': return '\\';
+    case 'x': {
+        int value = 0, digits = 0;
+        for (p++; digits < 2; p++, digits++) {
+            char c = *p;
+            if (c >= '0' && c <= '9') value = value * 16 + c - '0';
+            else if (c >= 'a' && c <= 'f') value = value * 16 + c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value = value * 16 + c - 'A' + 10;
+            else break;
+        }
+        if (digits == 0) return -2;
+        *end = p;
+        return value;
+    }
+    }
+
+    if (zero_octal ? *p != '0' : !is_octal(*p)) return -2;
+    if (zero_octal) p++;
+    int value = 0;
+    for (int digits = 0; digits < 3 && is_octal(*p); digits++, p++) value = value * 8 + *p - '0';
+    *end = p;
+    return value & 0xff;
+}
+
+// Writes s with its escapes interpreted; false if \c cut it short
+static bool put_escaped(const char *s, bool zero_octal, FILE *out) {
+    for (const char *p = s; *p;) {
+        if (*p != '\\' || !p[1]) {
+            fputc(*p++, out);
+            continue;
+        }
+        const char *end;
+        int c = read_escape(p + 1, &end, zero_octal);
+        if (c == -1) return false;
+        if (c == -2) {
+            fputc(*p++, out);
+            continue;
+        }
+        fputc(c, out);
+        p = end;
+    }
+    return true;
+}
+
+// Options as in bash, where escapes are off unless -e is given
+static int builtin_echo(int argc, char **argv) {
+    bool newline = true, escapes = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        const char *flags = argv[i] + 1;
+        if (flags[strspn(flags, "neE")]) break;
+        for (; *flags; flags++) {
+            if (*flags == 'n') newline = false;
+            else escapes = *flags == 'e';
+        }
+    }
+
+    for (; i < argc; i++) {
+        if (!escapes) fputs(argv[i], stdout);
+        else if (!put_escaped(argv[i], true, stdout)) return 0;
+        if (i + 1 < argc) putchar(' ');
+    }
+    if (newline) putchar('\n');
+    return 0;
+}
+
+// A numeric printf argument: C constants in any base, or 'c for the
+// value of the byte c. Complains but still uses what it could read.
+static bool printf_number(const char *arg, long long *value) {
+    if (!arg || !*arg) {
+        *value = 0;
+        return true;
+    }
+    if (arg[0] == '\'' || arg[0] == '"') {
+        *value = (unsigned char)arg[1];
+        return true;
+    }
+    char *end;
+    errno = 0;
+    *value = strtoll(arg, &end, 0);
+    if (*end || end == arg || errno) {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        return false;
+    }
+    return true;
+}
+
+// One pass over the format, taking arguments from argv[*next]. Returns
+// 1 if an argument was bad, -1 if \c ended the output.
+static int printf_format(const char *format, int argc, char **argv, int *next) {
+    int result = 0;
+    for (const char *p = format; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            const char *end;
+            int c = read_escape(p + 1, &end, false);
+            if (c == -1) return -1;
+            if (c == -2) {
+                putchar('\\');
+                continue;
+            }
+            putchar(c);
+            p = end - 1;
+            continue;
+        }
+        if (*p != '%') {
+            putchar(*p);
+            continue;
+        }
+        if (p[1] == '%') {
+            putchar('%');
+            p++;
+            continue;
+        }
+
+        // The directive up to its conversion, rebuilt for our printf
+        char spec[64] = "%";
+        size_t len = 1;
+        for (p++; *p && strchr("-+ #0", *p) && len < 8; p++) spec[len++] = *p;
+        for (int part = 0; part < 2; part++) {
+            if (part == 1) {
+                if (*p != '.') break;
+                spec[len++] = *p++;
+            }
+            if (*p == '*') {
+                long long n;
+                const char *arg = *next < argc ? argv[(*next)++] : NULL;
+                if (!printf_number(arg, &n)) result = 1;
+                len += snprintf(spec + len, sizeof(spec) - len, "%d", (int)n);
+                p++;
+            } else {
+                while (*p >= '0' && *p <= '9' && len < 40) spec[len++] = *p++;
+            }
+        }
+
+        char conversion = *p;
+        const char *arg = *next < argc ? argv[(*next)++] : NULL;
+        if (!conversion) {
+            fprintf(stderr, "printf: %s: missing format character\n", format);
             return 1;
         }
-        if (chdir(home) != 0) {
-            perror("cd");
+        switch (conversion) {
+        case 's':
+        case 'c': {
+            // %c is the argument's first byte, padded like a string
+            char first[2] = { arg ? arg[0] : '\0', '\0' };
+            strcpy(spec + len, "s");
+            printf(spec, conversion == 's' ? (arg ? arg : "") : first);
+            break;
+        }
+        case 'b': {
+            char *expanded = NULL;
+            size_t size = 0;
+            FILE *out = open_memstream(&expanded, &size);
+            if (!out) die("open_memstream");
+            bool more = put_escaped(arg ? arg : "", true, out);
+            fclose(out);
+            strcpy(spec + len, "s");
+            printf(spec, expanded);
+            free(expanded);
+            if (!more) return -1;
+            break;
+        }
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X': {
+            long long n;
+            if (!printf_number(arg, &n)) result = 1;
+            snprintf(spec + len, sizeof(spec) - len, "ll%c", conversion);
+            if (conversion == 'd' || conversion == 'i') printf(spec, n);
+            else printf(spec, (unsigned long long)n);
+            break;
+        }
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+            char *end;
+            double n = arg ? strtod(arg, &end) : 0;
+            if (arg && (*end || end == arg)) {
+                fprintf(stderr, "printf: %s: invalid number\n", arg);
+                result = 1;
+            }
+            snprintf(spec + len, sizeof(spec) - len, "%c", conversion);
+            printf(spec, n);
+            break;
+        }
+        default:
+            fprintf(stderr, "printf: %c: invalid format character\n", conversion);
             return 1;
         }
+    }
+    return result;
+}
+
+// The format is used again for as long as arguments are left
+static int builtin_printf(int argc, char **argv) {
+    int i = 1;
+    if (i < argc && strcmp(argv[i], "--") == 0) i++;
+    if (i >= argc) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    const char *format = argv[i++];
+
+    int result = 0;
+    do {
+        int first = i;
+        int pass = printf_format(format, argc, argv, &i);
+        if (pass < 0) break;
+        if (pass > 0) result = 1;
+        if (i == first) break;
+    } while (i < argc);
+    return result;
+}
+
+// test and [: the POSIX primaries, combined with ! ( ) -a and -o
+typedef struct {
+    int argc;
+    char **argv;
+    int pos;
+    char error[128];
+} Test;
+
+static const char *test_peek(const Test *t, int ahead) {
+    return t->pos + ahead < t->argc ? t->argv[t->pos + ahead] : NULL;
+}
+
+static void test_fail(Test *t, const char *what, const char *error) {
+    if (t->error[0]) return;
+    if (what) snprintf(t->error, sizeof(t->error), "%s: %s", what, error);
+    else snprintf(t->error, sizeof(t->error), "%s", error);
+}
+
+static bool is_test_binary(const char *op) {
+    static const char *ops[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef",
+    };
+    for (size_t i = 0; op && i < sizeof(ops) / sizeof(*ops); i++) {
+        if (strcmp(op, ops[i]) == 0) return true;
+    }
+    return false;
+}
+
+static bool is_test_unary(const char *op) {
+    return op[0] == '-' && op[1] && !op[2] && strchr("bcdefghknprstuwxzGLOS", op[1]);
+}
+
+static long long test_integer(Test *t, const char *s) {
+    char *end;
+    while (*s == ' ' || *s == '\t') s++;
+    long long n = strtoll(s, &end, 10);
+    while (*end == ' ' || *end == '\t') end++;
+    if (end == s || *end) test_fail(t, s, "integer expression expected");
+    return n;
+}
+
+static bool test_binary(Test *t, const char *a, const char *op, const char *b) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(a, b) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(a, b) != 0;
+    if (strcmp(op, "<") == 0) return strcmp(a, b) < 0;
+    if (strcmp(op, ">") == 0) return strcmp(a, b) > 0;
+
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+        struct stat sa, sb;
+        bool has_a = stat(a, &sa) == 0, has_b = stat(b, &sb) == 0;
+        if (op[1] == 'e') return has_a && has_b && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        if (!has_a || !has_b) return op[1] == 'n' ? has_a : has_b;
+        long long ta = sa.st_mtim.tv_sec * 1000000000LL + sa.st_mtim.tv_nsec;
+        long long tb = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+        return op[1] == 'n' ? ta > tb : ta < tb;
+    }
+
+    long long x = test_integer(t, a), y = test_integer(t, b);
+    if (strcmp(op, "-eq") == 0) return x == y;
+    if (strcmp(op, "-ne") == 0) return x != y;
+    if (strcmp(op, "-lt") == 0) return x < y;
+    if (strcmp(op, "-le") == 0) return x <= y;
+    if (strcmp(op, "-gt") == 0) return x > y;
+    return x >= y;
+}
+
+static bool test_unary(Test *t, char op, const char *arg) {
+    struct stat st;
+    switch (op) {
+    case 'n': return arg[0] != '\0';
+    case 'z': return arg[0] == '\0';
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    case 't': return isatty((int)test_integer(t, arg));
+    case 'h':
+    case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(arg, &st) != 0) return false;
+    switch (op) {
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'f': return S_ISREG(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'g': return st.st_mode & S_ISGID;
+    case 'u': return st.st_mode & S_ISUID;
+    case 'k': return st.st_mode & S_ISVTX;
+    case 'O': return st.st_uid == geteuid();
+    case 'G': return st.st_gid == getegid();
+    default:  return true;  // -e
+    }
+}
+
+static bool test_or(Test *t);
+
+static bool test_primary(Test *t) {
+    const char *a = test_peek(t, 0);
+    if (!a) {
+        test_fail(t, NULL, "argument expected");
+        return false;
+    }
+    const char *op = test_peek(t, 1);
+
+    // A binary operator wins, so [ ! = x ] and [ ( = ( ] compare strings
+    if (is_test_binary(op) && test_peek(t, 2)) {
+        t->pos += 3;
+        return test_binary(t, a, op, t->argv[t->pos - 1]);
+    }
+    if (strcmp(a, "(") == 0 && op) {
+        t->pos++;
+        bool result = test_or(t);
+        const char *close = test_peek(t, 0);
+        if (!close || strcmp(close, ")") != 0) test_fail(t, NULL, "`)' expected");
+        else t->pos++;
+        return result;
+    }
+    if (is_test_unary(a) && op) {
+        t->pos += 2;
+        return test_unary(t, a[1], op);
+    }
+    t->pos++;
+    return a[0] != '\0';
+}
+
+static bool test_not(Test *t) {
+    const char *a = test_peek(t, 0);
+    if (a && strcmp(a, "!") == 0 && test_peek(t, 1)
+        && !(is_test_binary(test_peek(t, 1)) && test_peek(t, 2))) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static bool test_and(Test *t) {
+    bool result = test_not(t);
+    while (test_peek(t, 0) && strcmp(test_peek(t, 0), "-a") == 0) {
+        t->pos++;
+        result = test_not(t) && result;
+    }
+    return result;
+}
+
+static bool test_or(Test *t) {
+    bool result = test_and(t);
+    while (test_peek(t, 0) && strcmp(test_peek(t, 0), "-o") == 0) {
+        t->pos++;
+        result = test_and(t) || result;
+    }
+    return result;
+}
+
+static int builtin_test(int argc, char **argv) {
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing `]'\n");
+            return 2;
+        }
+        argc--;
+    }
+    if (argc == 1) return 1;
+
+    Test t = { .argc = argc, .argv = argv, .pos = 1 };
+    bool result = test_or(&t);
+    if (t.pos < argc) {
+        if (argc == 3) test_fail(&t, argv[1], "unary operator expected");
+        else test_fail(&t, NULL, "too many arguments");
+    }
+    if (t.error[0]) {
+        fprintf(stderr, "%s: %s\n", argv[0], t.error);
+        return 2;
+    }
+    return result ? 0 : 1;
+}
+
+static bool valid_name(const char *name, size_t len) {
+    if (len == 0 || (name[0] >= '0' && name[0] <= '9')) return false;
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// What the shell caches from the environment goes stale with it
+static void environment_changed(const char *name) {
+    if (strcmp(name, "HOME") == 0) prompt_invalidate();
+    if (strcmp(name, "PATH") == 0) {
+        command_cache_sync_path();
+        exec_forget();
+    }
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// export -p: the environment as commands that would recreate it
+static void print_environment(void) {
+    size_t count = 0;
+    while (environ[count]) count++;
+    char **sorted = malloc((count + 1) * sizeof(char *));
+    if (!sorted) die("malloc");
+    memcpy(sorted, environ, count * sizeof(char *));
+    qsort(sorted, count, sizeof(char *), compare_strings);
+
+    for (size_t i = 0; i < count; i++) {
+        const char *eq = strchr(sorted[i], '=');
+        if (!eq) continue;
+        printf("export %.*s='", (int)(eq - sorted[i]), sorted[i]);
+        for (const char *p = eq + 1; *p; p++) {
+            if (*p == '\'') fputs("'\\''", stdout);
+            else putchar(*p);
+        }
+        printf("'\n");
+    }
+    free(sorted);
+}
+
+// Every variable the shell keeps is in the environment, so NAME on its
+// own has nothing to export; -n takes a name out of it
+static int builtin_export(int argc, char **argv) {
+    bool unexport = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-n") == 0) {
+            unexport = true;
+        } else if (strcmp(argv[i], "-p") != 0) {
+            fprintf(stderr, "export: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
+    if (i == argc) {
+        print_environment();
         return 0;
     }
 
-    // Skip "cd " to get the path
-    const char *path = cmd + 3;
+    int result = 0;
+    for (; i < argc; i++) {
+        const char *eq = strchr(argv[i], '=');
+        size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (!valid_name(argv[i], len)) {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", argv[i]);
+            result = 1;
+            continue;
+        }
+        char *name = strndup(argv[i], len);
+        if (!name) die("strndup");
+        if (unexport) unsetenv(name);
+        else if (eq) setenv(name, eq + 1, 1);
+        environment_changed(name);
+        free(name);
+    }
+    return result;
+}
 
-    // Trim leading spaces
-    while (*path == ' ') path++;
+// There are no shell functions, so -f has nothing to remove
+static int builtin_unset(int argc, char **argv) {
+    bool functions = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-f") == 0) {
+            functions = true;
+        } else if (strcmp(argv[i], "-v") != 0) {
+            fprintf(stderr, "unset: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
 
-    // Handle '~' to go to HOME directory
-    if (strcmp(path, "~") == 0) {
-        path = getenv("HOME");
-        if (!path) {
-            fprintf(stderr, "HOME not set\n");
-            return 1;
+    int result = 0;
+    for (; i < argc && !functions; i++) {
+        if (!valid_name(argv[i], strlen(argv[i]))) {
+            fprintf(stderr, "unset: `%s': not a valid identifier\n", argv[i]);
+            result = 1;
+            continue;
         }
+        unsetenv(argv[i]);
+        environment_changed(argv[i]);
     }
+    return result;
+}
 
-    if (chdir(path) != 0) {
-        perror("cd");
-        return 1;
+// -t prints only the kind of each name, -p only the file it runs, and
+// -P looks for a file even for keywords and builtins
+static int builtin_type(int argc, char **argv) {
+    bool kind_only = false, path_only = false, force_path = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *flag = argv[i] + 1; *flag; flag++) {
+            if (*flag == 't') kind_only = true;
+            else if (*flag == 'p') path_only = true;
+            else if (*flag == 'P') path_only = force_path = true;
+            else {
+                fprintf(stderr, "type: -%c: invalid option\n", *flag);
+                return 2;
+            }
+        }
     }
-    return 0;
+
+    int result = 0;
+    for (; i < argc; i++) {
+        const char *name = argv[i];
+        if (!force_path && is_keyword(name)) {
+            if (kind_only) puts("keyword");
+            else if (!path_only) printf("%s is a shell keyword\n", name);
+            continue;
+        }
+        if (!force_path && (is_builtin(name) || is_sh_builtin(name))) {
+            if (kind_only) puts("builtin");
+            else if (!path_only) printf("%s is a shell builtin\n", name);
+            continue;
+        }
+
+        const char *hashed = strchr(name, '/') ? NULL : exec_hashed(name);
+        char *path = NULL;
+        if (!hashed) {
+            struct stat st;
+            if (!strchr(name, '/')) path = exec_search_path(name);
+            else if (stat(name, &st) == 0 && S_ISREG(st.st_mode) && access(name, X_OK) == 0) path = strdup(name);
+        }
+        if (!hashed && !path) {
+            if (!kind_only && !path_only) fprintf(stderr, "type: %s: not found\n", name);
+            result = 1;
+            continue;
+        }
+        if (kind_only) puts("file");
+        else if (path_only) puts(hashed ? hashed : path);
+        else if (hashed) printf("%s is hashed (%s)\n", name, hashed);
+        else printf("%s is %s\n", name, path);
+        free(path);
+    }
+    return result;
+}
+
+// The PATH lookups the shell remembers: hash lists them, hash NAME
+// looks one up now and hash -r forgets them all
+static int builtin_hash(int argc, char **argv) {
+    int i = 1;
+    bool forget = false;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-r") != 0) {
+            fprintf(stderr, "hash: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+        forget = true;
+    }
+    if (forget) exec_forget();
+    if (i == argc) {
+        if (!forget) exec_print_hashed();
+        return 0;
+    }
+
+    int result = 0;
+    for (; i < argc; i++) {
+        if (strchr(argv[i], '/') || is_builtin(argv[i])) continue;
+        if (!exec_hash(argv[i])) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            result = 1;
+        }
+    }
+    return result;
+}
+
+// The registry, placed by a perfect hash of each name's length and
+// first two bytes (the second is the terminator of a one-byte name).
+// C cannot index a string literal in a constant expression, so those
+// bytes are spelled out next to it. Two names in one slot make the
+// later initializer override the earlier, which -Wextra reports
+// (-Woverride-init): pick another multiplier when adding one does.
+#define BUILTIN_SLOTS 64
+#define BUILTIN_HASH(first, second, length) \
+    (((unsigned)(first) + (unsigned)(second) * 19 + (unsigned)(length)) & (BUILTIN_SLOTS - 1))
+#define BUILTIN(first, second, name, run) \
+    [BUILTIN_HASH(first, second, sizeof(name) - 1)] = { name, run }
+
+static const Builtin builtins[BUILTIN_SLOTS] = {
+    BUILTIN('c', 'd', "cd", cd),
+    BUILTIN('c', 'o', "colors", colors),
+    BUILTIN('s', 't', "stats", stats),
+    BUILTIN('j', 'o', "jobs", jobs_builtin),
+    BUILTIN('f', 'g', "fg", fg_builtin),
+    BUILTIN('b', 'g', "bg", bg_builtin),
+    BUILTIN('e', 'c', "echo", builtin_echo),
+    BUILTIN('p', 'r', "printf", builtin_printf),
+    BUILTIN('p', 'w', "pwd", builtin_pwd),
+    BUILTIN('t', 'r', "true", builtin_true),
+    BUILTIN(':', '\0', ":", builtin_true),
+    BUILTIN('f', 'a', "false", builtin_false),
+    BUILTIN('t', 'e', "test", builtin_test),
+    BUILTIN('[', '\0', "[", builtin_test),
+    BUILTIN('e', 'x', "export", builtin_export),
+    BUILTIN('u', 'n', "unset", builtin_unset),
+    BUILTIN('t', 'y', "type", builtin_type),
+    BUILTIN('h', 'a', "hash", builtin_hash),
+};
+
+static const Builtin *find_builtin(const char *name) {
+    if (!name[0]) return NULL;
+    const Builtin *builtin = &builtins[BUILTIN_HASH((unsigned char)name[0],
+                                                   (unsigned char)name[1], strlen(name))];
+    return builtin->name && strcmp(builtin->name, name) == 0 ? builtin : NULL;
+}
+
+int is_builtin(const char *name) {
+    return find_builtin(name) != NULL;
+}
+
+int handle_builtin(int argc, char **argv) {
+    const Builtin *builtin = find_builtin(argv[0]);
+    if (!builtin) return 1; // Command not handled
+    return builtin->run(argc, argv);
 }
@@ -1,10 +1,14 @@
 #ifndef BUILTIN_H
 #define BUILTIN_H
 
-int is_builtin(const char *cmd);
-int handle_builtin(const char *cmd);
+// Builtins run in the shell itself; words arrive expanded.
+// Names are found in a fixed table through a perfect hash, so checking
+// a word (as highlighting does on every keystroke) costs one compare.
+int is_builtin(const char *name);
+int handle_builtin(int argc, char **argv);
 
-int cd(const char *cmd);
-int colors();
+int cd(int argc, char **argv);
+int colors(int argc, char **argv);
+int stats(int argc, char **argv);
 
 #endif
@@ -126,27 +126,7 @@ void yank(Line *line, char *clipboard) {
         return;
     }
     
-    // Calculate space needed
-    size_t paste_len = strlen(clipboard);
-    if (line->length + paste_len >= LINE_MAX - 1) {
-        paste_len = LINE_MAX - 1 - line->length;
-    }
-    
-    if (paste_len == 0) {
-        return;
-    }
-    
-    // Make space for new content
-    memmove(line->buffer + line->point + paste_len,
-            line->buffer + line->point,
-            line->length - line->point);
-    
     // Insert clipboard content
-    memcpy(line->buffer + line->point, clipboard, paste_len);
-    line->point += paste_len;
-    line->length += paste_len;
-    line->buffer[line->length] = '\0';
-    
-    clear_line(line);
+    line_insert(line, clipboard, strlen(clipboard));
 }
 
@@ -0,0 +1,996 @@
+#include "command_cache.h"
+#include "line.h"
+#include "util.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+// Every command name lives once in `names`, NUL terminated.
+// Offset 0 holds an empty string so a zero offset marks an empty slot.
+//
+// Lookups go through an open-addressing hash set (linear probing,
+// kept at most half full), prefix queries through `sorted`, the same
+// offsets ordered by strcmp so a prefix is a contiguous range.
+
+typedef struct {
+    uint32_t hash;
+    uint32_t offset;
+    uint32_t len;
+    uint32_t dirs;  // How many PATH directories provide this name
+} CommandSlot;
+
+// Executables found in one PATH directory, NUL separated
+typedef struct {
+    char *path;
+    char *names;
+    size_t names_len;
+    size_t names_capacity;
+    size_t count;
+
+    // Identity of the directory when it was listed; a cached listing
+    // is reused only while all of these still match
+    bool exists;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+
+    bool listed;  // names is up to date
+    bool loaded;  // names came from the cache file (and point into it)
+    int wd;       // inotify watch, or -1
+} PathDir;
+
+typedef struct {
+    char *names;
+    size_t names_len;
+    size_t names_capacity;
+
+    char *path;     // PATH the directories were taken from
+    PathDir *dirs;  // In PATH order
+    size_t dirs_count;
+    size_t dirs_scanned;
+    long long scan_ns;
+
+    // When the whole index was adopted from the cache file, names,
+    // slots and sorted point into this mapping instead of the heap
+    void *map;
+    size_t map_size;
+    bool mapped;
+
+    int inotify_fd;
+    size_t events_applied;
+
+    CommandSlot *slots;
+    size_t slots_capacity;  // Always a power of two
+    size_t count;
+
+    uint32_t *sorted;
+    bool sorted_dirty;
+} CommandCache;
+
+static CommandCache cache = { .inotify_fd = -1 };
+
+static CommandSlot *find_slot(const char *name, size_t len, uint32_t hash) {
+    size_t mask = cache.slots_capacity - 1;
+    size_t i = hash & mask;
+
+    while (cache.slots[i].offset != 0) {
+        CommandSlot *slot = &cache.slots[i];
+        if (slot->hash == hash && slot->len == len
+            && memcmp(cache.names + slot->offset, name, len) == 0) {
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
+    return &cache.slots[i];
+}
+
+static void grow_slots(void) {
+    CommandSlot *old = cache.slots;
+    size_t old_capacity = cache.slots_capacity;
+
+    cache.slots_capacity = old_capacity ? old_capacity * 2 : 1024;
+    cache.slots = calloc(cache.slots_capacity, sizeof(CommandSlot));
+    if (!cache.slots) die("calloc");
+
+    size_t mask = cache.slots_capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].offset == 0) continue;
+        size_t j = old[i].hash & mask;
+        while (cache.slots[j].offset != 0) j = (j + 1) & mask;
+        cache.slots[j] = old[i];
+    }
+    free(old);
+}
+
+// Copy an index adopted from the cache file to the heap before the
+// first change; the mapping stays alive for the directory listings
+static void make_owned(void) {
+    if (!cache.mapped) return;
+
+    char *names = malloc(cache.names_len);
+    CommandSlot *slots = malloc(cache.slots_capacity * sizeof(CommandSlot));
+    uint32_t *sorted = malloc((cache.count ? cache.count : 1) * sizeof(uint32_t));
+    if (!names || !slots || !sorted) die("malloc");
+
+    memcpy(names, cache.names, cache.names_len);
+    memcpy(slots, cache.slots, cache.slots_capacity * sizeof(CommandSlot));
+    memcpy(sorted, cache.sorted, cache.count * sizeof(uint32_t));
+
+    cache.names = names;
+    cache.names_capacity = cache.names_len;
+    cache.slots = slots;
+    cache.sorted = sorted;
+    cache.mapped = false;
+}
+
+static uint32_t store_name(const char *name, size_t len) {
+    if (cache.names_len + len + 1 > cache.names_capacity) {
+        size_t capacity = cache.names_capacity ? cache.names_capacity : 16384;
+        while (cache.names_len + len + 1 > capacity) capacity *= 2;
+        cache.names = realloc(cache.names, capacity);
+        if (!cache.names) die("realloc");
+        cache.names_capacity = capacity;
+    }
+
+    uint32_t offset = cache.names_len;
+    memcpy(cache.names + offset, name, len);
+    cache.names[offset + len] = '\0';
+    cache.names_len += len + 1;
+    return offset;
+}
+
+// Add a command name provided by one more directory
+static void command_cache_add(const char *name, size_t len) {
+    if (len == 0) return;
+    make_owned();
+    if ((cache.count + 1) * 2 > cache.slots_capacity) grow_slots();
+
+    uint32_t hash = hash_bytes(name, len);
+    CommandSlot *slot = find_slot(name, len, hash);
+    if (slot->offset != 0) {
+        slot->dirs++;
+        return;
+    }
+
+    slot->hash = hash;
+    slot->len = len;
+    slot->dirs = 1;
+    slot->offset = store_name(name, len);
+    cache.count++;
+    cache.sorted_dirty = true;
+}
+
+// Drop one directory's claim on a name, deleting it with the last one.
+// Deletion shifts the rest of the probe run back instead of leaving a
+// tombstone, so lookups never slow down. The name's bytes stay in the
+// string table until the next full rebuild.
+static void command_cache_remove(const char *name, size_t len) {
+    if (len == 0 || !cache.slots) return;
+    make_owned();
+
+    CommandSlot *slot = find_slot(name, len, hash_bytes(name, len));
+    if (slot->offset == 0 || --slot->dirs > 0) return;
+
+    size_t mask = cache.slots_capacity - 1;
+    size_t i = slot - cache.slots;
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (cache.slots[j].offset == 0) break;
+        size_t home = cache.slots[j].hash & mask;
+        // Move slot j into the hole unless its home lies in (i, j]
+        bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            cache.slots[i] = cache.slots[j];
+            i = j;
+        }
+    }
+    cache.slots[i] = (CommandSlot){0};
+    cache.count--;
+    cache.sorted_dirty = true;
+}
+
+static int compare_offsets(const void *a, const void *b) {
+    return strcmp(cache.names + *(const uint32_t *)a,
+                  cache.names + *(const uint32_t *)b);
+}
+
+static void build_sorted(void) {
+    if (!cache.sorted_dirty) return;
+
+    free(cache.sorted);
+    cache.sorted = malloc((cache.count ? cache.count : 1) * sizeof(uint32_t));
+    if (!cache.sorted) die("malloc");
+
+    size_t n = 0;
+    for (size_t i = 0; i < cache.slots_capacity; i++) {
+        if (cache.slots[i].offset != 0) {
+            cache.sorted[n++] = cache.slots[i].offset;
+        }
+    }
+    qsort(cache.sorted, n, sizeof(uint32_t), compare_offsets);
+    cache.sorted_dirty = false;
+}
+
+static void path_dir_add(PathDir *dir, const char *name, size_t len) {
+    if (dir->names_len + len + 1 > dir->names_capacity) {
+        size_t capacity = dir->names_capacity ? dir->names_capacity : 4096;
+        while (dir->names_len + len + 1 > capacity) capacity *= 2;
+        dir->names = realloc(dir->names, capacity);
+        if (!dir->names) die("realloc");
+        dir->names_capacity = capacity;
+    }
+    memcpy(dir->names + dir->names_len, name, len + 1);
+    dir->names_len += len + 1;
+    dir->count++;
+}
+
+// Everything is resolved relative to the directory fd, and d_type
+// lets us skip subdirectories without touching the inode at all.
+static void scan_dir(PathDir *dir) {
+    int fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    DIR *d = fdopendir(fd);
+    if (!d) {
+        close(fd);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_type == DT_DIR) continue;
+        if (entry->d_name[0] == '.'
+            && (entry->d_name[1] == '\0'
+                || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
+            continue;
+        }
+        if (faccessat(fd, entry->d_name, X_OK, 0) == 0) {
+            path_dir_add(dir, entry->d_name, strlen(entry->d_name));
+        }
+    }
+    closedir(d);
+}
+
+static void path_dir_clear(PathDir *dir) {
+    if (!dir->loaded) free(dir->names);
+    dir->names = NULL;
+    dir->names_len = 0;
+    dir->names_capacity = 0;
+    dir->count = 0;
+    dir->loaded = false;
+}
+
+// Copy a listing that points into the cache file before editing it
+static void path_dir_own(PathDir *dir) {
+    if (!dir->loaded) return;
+    char *names = malloc(dir->names_len ? dir->names_len : 1);
+    if (!names) die("malloc");
+    memcpy(names, dir->names, dir->names_len);
+    dir->names = names;
+    dir->names_capacity = dir->names_len;
+    dir->loaded = false;
+}
+
+static bool path_dir_find(const PathDir *dir, const char *name, size_t len, size_t *offset) {
+    for (size_t off = 0; off < dir->names_len;) {
+        size_t entry_len = strlen(dir->names + off);
+        if (entry_len == len && memcmp(dir->names + off, name, len) == 0) {
+            *offset = off;
+            return true;
+        }
+        off += entry_len + 1;
+    }
+    return false;
+}
+
+// Add or remove every name of a directory from the merged index
+static void index_dir(const PathDir *dir, bool add) {
+    for (size_t off = 0; off < dir->names_len;) {
+        size_t len = strlen(dir->names + off);
+        if (add) command_cache_add(dir->names + off, len);
+        else command_cache_remove(dir->names + off, len);
+        off += len + 1;
+    }
+}
+
+#define SCAN_THREADS_MAX 8
+
+typedef struct {
+    PathDir *dirs;
+    size_t count;
+    size_t next;  // Next directory to hand out
+    pthread_mutex_t lock;
+} ScanQueue;
+
+static void *scan_worker(void *arg) {
+    ScanQueue *queue = arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        size_t i = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (i >= queue->count) return NULL;
+        if (!queue->dirs[i].listed) {
+            scan_dir(&queue->dirs[i]);
+            queue->dirs[i].listed = true;
+        }
+    }
+}
+
+// Scan directories on a small thread pool; each worker only ever
+// writes to the PathDir it claimed, so no other locking is needed.
+static void scan_dirs(PathDir *dirs, size_t count) {
+    ScanQueue queue = { .dirs = dirs, .count = count };
+    pthread_mutex_init(&queue.lock, NULL);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = count < SCAN_THREADS_MAX ? count : SCAN_THREADS_MAX;
+    if (cpus > 0 && (size_t)cpus * 2 < threads) threads = cpus * 2;
+
+    pthread_t workers[SCAN_THREADS_MAX];
+    size_t started = 0;
+    // The calling thread takes part too
+    while (started + 1 < threads
+           && pthread_create(&workers[started], NULL, scan_worker, &queue) == 0) {
+        started++;
+    }
+    scan_worker(&queue);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&queue.lock);
+}
+
+// Split PATH into directories, dropping empty and repeated entries
+static PathDir *collect_path_dirs(const char *path, size_t *count) {
+    char *path_copy = strdup(path);
+    if (!path_copy) die("strdup");
+
+    size_t capacity = 8;
+    PathDir *dirs = calloc(capacity, sizeof(PathDir));
+    if (!dirs) die("calloc");
+    *count = 0;
+
+    for (char *dir_str = strtok(path_copy, ":"); dir_str; dir_str = strtok(NULL, ":")) {
+        bool seen = false;
+        for (size_t i = 0; i < *count && !seen; i++) {
+            seen = strcmp(dirs[i].path, dir_str) == 0;
+        }
+        if (seen) continue;
+
+        if (*count == capacity) {
+            capacity *= 2;
+            dirs = realloc(dirs, capacity * sizeof(PathDir));
+            if (!dirs) die("realloc");
+        }
+        dirs[(*count)++] = (PathDir){ .path = strdup(dir_str), .wd = -1 };
+    }
+    free(path_copy);
+    return dirs;
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void stat_path_dir(PathDir *dir) {
+    struct stat st;
+    dir->exists = stat(dir->path, &st) == 0 && S_ISDIR(st.st_mode);
+    if (!dir->exists) return;
+    dir->dev = st.st_dev;
+    dir->ino = st.st_ino;
+    dir->mtime = st.st_mtim;
+}
+
+//// Persistent cache
+//
+// The cache file is a snapshot of the whole index, laid out so it can
+// be used straight from an mmap:
+//
+//   CacheHeader
+//   CacheDirRecord[dirs_count]   identity of each PATH directory
+//   blobs                        directory paths and per-directory names
+//   names                        merged string table
+//   slots                        hash set, same layout as in memory
+//   sorted                       prefix order
+//
+// On a warm start every directory is only stat()ed. If they all match,
+// the mapped index is used as is. Otherwise the listings of unchanged
+// directories are reused, only the changed ones are read again, and a
+// new file replaces the old one.
+
+#define CACHE_MAGIC "SHCMDS02"
+
+typedef struct {
+    char magic[8];
+    uint32_t dirs_count;
+    uint32_t count;
+    uint64_t slots_capacity;
+    uint64_t names_len;
+    uint64_t dirs_offset;
+    uint64_t blobs_offset;
+    uint64_t names_offset;
+    uint64_t slots_offset;
+    uint64_t sorted_offset;
+    uint64_t file_size;
+} CacheHeader;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t exists;
+    uint32_t count;
+    uint64_t path_offset;  // Relative to blobs
+    uint64_t path_len;
+    uint64_t names_offset; // Relative to blobs
+    uint64_t names_len;
+} CacheDirRecord;
+
+static char *cache_file_path(void) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *suffix = "/shell/commands";
+    char path[PATH_MAX];
+
+    if (base && *base) {
+        snprintf(path, sizeof(path), "%s%s", base, suffix);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home) return NULL;
+        snprintf(path, sizeof(path), "%s/.cache%s", home, suffix);
+    }
+    return strdup(path);
+}
+
+static bool dir_matches(const PathDir *dir, const CacheDirRecord *record) {
+    if (!dir->exists || !record->exists) return dir->exists == (bool)record->exists;
+    return record->dev == (uint64_t)dir->dev
+        && record->ino == (uint64_t)dir->ino
+        && record->mtime_sec == (int64_t)dir->mtime.tv_sec
+        && record->mtime_nsec == (int64_t)dir->mtime.tv_nsec;
+}
+
+// Whether count items of item bytes at offset fit in size bytes. Written
+// so that the values of a corrupt file cannot overflow the arithmetic.
+static bool within(uint64_t offset, uint64_t count, size_t item, size_t size) {
+    return offset <= size && count <= (size - offset) / item;
+}
+
+// Name lists are walked with strlen, so they must end in a terminator
+static bool names_valid(const char *names, uint64_t len) {
+    return len == 0 || names[len - 1] == '\0';
+}
+
+// The hash set and prefix view are used as they are in the file, so
+// every offset must land on a name and the set must keep an empty slot
+// for probes to stop at. Offset 0 is the empty string marking free slots.
+static bool index_valid(const char *base, const CacheHeader *header) {
+    const char *names = base + header->names_offset;
+    const CommandSlot *slots = (const void *)(base + header->slots_offset);
+    const uint32_t *sorted = (const void *)(base + header->sorted_offset);
+    uint64_t names_len = header->names_len;
+
+    if (names_len == 0 || names[0] != '\0') return false;
+    if (header->count > header->slots_capacity / 2) return false;
+
+    size_t used = 0;
+    for (size_t i = 0; i < header->slots_capacity; i++) {
+        const CommandSlot *slot = &slots[i];
+        if (slot->offset == 0) continue;
+        if ((uint64_t)slot->offset + slot->len >= names_len
+            || names[slot->offset + slot->len] != '\0') {
+            return false;
+        }
+        used++;
+    }
+    if (used != header->count) return false;
+
+    for (size_t i = 0; i < header->count; i++) {
+        if (sorted[i] >= names_len) return false;
+    }
+    return true;
+}
+
+// Map the cache file and reuse whatever is still valid. Returns true
+// when the mapped index covers the current PATH exactly.
+static bool load_cache_file(const char *file) {
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const char *base = map;
+    const CacheHeader *header = map;
+    size_t size = st.st_size;
+    if (memcmp(header->magic, CACHE_MAGIC, 8) != 0
+        || header->file_size != size
+        || !within(header->dirs_offset, header->dirs_count, sizeof(CacheDirRecord), size)
+        || header->blobs_offset > size
+        || !within(header->names_offset, header->names_len, 1, size)
+        || !names_valid(base + header->names_offset, header->names_len)
+        || header->slots_capacity == 0
+        || (header->slots_capacity & (header->slots_capacity - 1)) != 0
+        || !within(header->slots_offset, header->slots_capacity, sizeof(CommandSlot), size)
+        || !within(header->sorted_offset, header->count, sizeof(uint32_t), size)
+        || !index_valid(base, header)) {
+        munmap(map, size);
+        return false;
+    }
+
+    // Every record is checked before any of them is used
+    const CacheDirRecord *records = (const void *)(base + header->dirs_offset);
+    const char *blobs = base + header->blobs_offset;
+    size_t blobs_size = size - header->blobs_offset;
+    for (size_t r = 0; r < header->dirs_count; r++) {
+        const CacheDirRecord *record = &records[r];
+        if (!within(record->path_offset, record->path_len, 1, blobs_size)
+            || !within(record->names_offset, record->names_len, 1, blobs_size)
+            || !names_valid(blobs + record->names_offset, record->names_len)) {
+            munmap(map, size);
+            return false;
+        }
+    }
+
+    cache.map = map;
+    cache.map_size = size;
+    bool exact = header->dirs_count == cache.dirs_count;
+
+    for (size_t i = 0; i < cache.dirs_count; i++) {
+        PathDir *dir = &cache.dirs[i];
+        bool found = false;
+
+        for (size_t r = 0; r < header->dirs_count && !found; r++) {
+            const CacheDirRecord *record = &records[r];
+            if (record->path_len != strlen(dir->path)
+                || memcmp(blobs + record->path_offset, dir->path, record->path_len) != 0) {
+                continue;
+            }
+            found = true;
+            if (!dir_matches(dir, record)) break;  // Changed, list it again
+            if (r != i) exact = false;
+
+            dir->names = (char *)blobs + record->names_offset;
+            dir->names_len = record->names_len;
+            dir->count = record->count;
+            dir->listed = true;
+            dir->loaded = true;
+        }
+        if (!dir->loaded) exact = false;
+    }
+
+    if (!exact) return false;
+
+    cache.names = (char *)base + header->names_offset;
+    cache.names_len = header->names_len;
+    cache.slots = (CommandSlot *)(base + header->slots_offset);
+    cache.slots_capacity = header->slots_capacity;
+    cache.sorted = (uint32_t *)(base + header->sorted_offset);
+    cache.count = header->count;
+    cache.sorted_dirty = false;
+    cache.mapped = true;
+    return true;
+}
+
+// Write the current index to a temporary file and rename it over the
+// old one, so readers only ever see a complete cache
+static void save_cache_file(const char *file) {
+    CacheHeader header = {0};
+    memcpy(header.magic, CACHE_MAGIC, 8);
+    header.dirs_count = cache.dirs_count;
+    header.count = cache.count;
+    header.slots_capacity = cache.slots_capacity;
+    header.names_len = cache.names_len;
+
+    size_t blobs_len = 0;
+    for (size_t i = 0; i < cache.dirs_count; i++) {
+        blobs_len += strlen(cache.dirs[i].path) + 1 + cache.dirs[i].names_len;
+    }
+
+    header.dirs_offset = align8(sizeof(header));
+    header.blobs_offset = header.dirs_offset + cache.dirs_count * sizeof(CacheDirRecord);
+    header.names_offset = align8(header.blobs_offset + blobs_len);
+    header.slots_offset = align8(header.names_offset + cache.names_len);
+    header.sorted_offset = header.slots_offset + cache.slots_capacity * sizeof(CommandSlot);
+    header.file_size = header.sorted_offset + cache.count * sizeof(uint32_t);
+
+    char *buffer = calloc(1, header.file_size);
+    if (!buffer) return;
+
+    memcpy(buffer, &header, sizeof(header));
+    CacheDirRecord *records = (CacheDirRecord *)(buffer + header.dirs_offset);
+    char *blobs = buffer + header.blobs_offset;
+    size_t blob_pos = 0;
+
+    for (size_t i = 0; i < cache.dirs_count; i++) {
+        const PathDir *dir = &cache.dirs[i];
+        CacheDirRecord *record = &records[i];
+        size_t path_len = strlen(dir->path);
+
+        record->exists = dir->exists;
+        record->dev = dir->dev;
+        record->ino = dir->ino;
+        record->mtime_sec = dir->mtime.tv_sec;
+        record->mtime_nsec = dir->mtime.tv_nsec;
+        record->count = dir->count;
+
+        record->path_offset = blob_pos;
+        record->path_len = path_len;
+        memcpy(blobs + blob_pos, dir->path, path_len + 1);
+        blob_pos += path_len + 1;
+
+        record->names_offset = blob_pos;
+        record->names_len = dir->names_len;
+        if (dir->names_len) memcpy(blobs + blob_pos, dir->names, dir->names_len);
+        blob_pos += dir->names_len;
+    }
+
+    memcpy(buffer + header.names_offset, cache.names, cache.names_len);
+    memcpy(buffer + header.slots_offset, cache.slots,
+           cache.slots_capacity * sizeof(CommandSlot));
+    memcpy(buffer + header.sorted_offset, cache.sorted, cache.count * sizeof(uint32_t));
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file);
+    mkdir_parents(tmp);
+    int fd = mkstemp(tmp);
+    if (fd != -1) {
+        bool ok = write_all(fd, buffer, header.file_size);
+        close(fd);
+        if (!ok || rename(tmp, file) == -1) unlink(tmp);
+    }
+    free(buffer);
+}
+
+//// Live refresh
+//
+// Each PATH directory is watched with inotify. Events are drained from
+// the input loop whenever the descriptor becomes readable, and every
+// touched name is checked again on its own, so installing or removing
+// a binary costs one stat, never a rescan.
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+                    | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static void watch_dir(PathDir *dir) {
+    if (cache.inotify_fd == -1 || !dir->exists) return;
+    dir->wd = inotify_add_watch(cache.inotify_fd, dir->path, WATCH_MASK);
+}
+
+static void unwatch_dir(PathDir *dir) {
+    if (cache.inotify_fd != -1 && dir->wd != -1) {
+        inotify_rm_watch(cache.inotify_fd, dir->wd);
+    }
+    dir->wd = -1;
+}
+
+// Same rule as scan_dir(): anything but a directory that we may execute
+static bool is_executable_entry(const PathDir *dir, const char *name) {
+    char full_path[PATH_MAX];
+    struct stat st;
+    snprintf(full_path, sizeof(full_path), "%s/%s", dir->path, name);
+    return lstat(full_path, &st) == 0 && !S_ISDIR(st.st_mode)
+        && access(full_path, X_OK) == 0;
+}
+
+static bool refresh_entry(PathDir *dir, const char *name) {
+    size_t len = strlen(name);
+    size_t offset = 0;
+    bool present = path_dir_find(dir, name, len, &offset);
+    if (present == is_executable_entry(dir, name)) return false;
+
+    path_dir_own(dir);
+    if (present) {
+        memmove(dir->names + offset, dir->names + offset + len + 1,
+                dir->names_len - offset - len - 1);
+        dir->names_len -= len + 1;
+        dir->count--;
+        command_cache_remove(name, len);
+    } else {
+        path_dir_add(dir, name, len);
+        command_cache_add(name, len);
+    }
+    return true;
+}
+
+static void rescan_dir(PathDir *dir) {
+    index_dir(dir, false);
+    path_dir_clear(dir);
+    stat_path_dir(dir);
+    scan_dir(dir);
+    dir->listed = true;
+    index_dir(dir, true);
+    cache.dirs_scanned++;
+}
+
+// A directory without a watch was missing, or was deleted or moved away
+// since. Once it is back, watch it and read it again. The watch comes
+// first so nothing created in between is missed.
+static bool revive_dir(PathDir *dir) {
+    if (cache.inotify_fd == -1 || dir->wd != -1) return false;
+    stat_path_dir(dir);
+    watch_dir(dir);
+    if (dir->wd == -1) return false;
+    rescan_dir(dir);
+    return true;
+}
+
+// After an overflow no watch can be trusted: the directory may have been
+// replaced and the IN_IGNORED for the old one lost. Watching the path
+// again gives the same descriptor when it is the same directory.
+static void rewatch_dir(PathDir *dir) {
+    int old = dir->wd;
+    dir->wd = -1;
+    stat_path_dir(dir);
+    watch_dir(dir);
+    if (old != -1 && old != dir->wd) inotify_rm_watch(cache.inotify_fd, old);
+    rescan_dir(dir);
+}
+
+int command_cache_watch_fd(void) {
+    return cache.inotify_fd;
+}
+
+bool command_cache_process_events(void) {
+    if (cache.inotify_fd == -1) return false;
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t n;
+
+    while ((n = read(cache.inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + n;) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            // Events, including IN_IGNORED for lost watches, were dropped
+            if (event->mask & IN_Q_OVERFLOW) {
+                for (size_t i = 0; i < cache.dirs_count; i++) {
+                    rewatch_dir(&cache.dirs[i]);
+                }
+                changed = true;
+                continue;
+            }
+
+            PathDir *dir = NULL;
+            for (size_t i = 0; i < cache.dirs_count && !dir; i++) {
+                if (cache.dirs[i].wd == event->wd) dir = &cache.dirs[i];
+            }
+            if (!dir) continue;
+
+            if (event->mask & IN_IGNORED) {
+                dir->wd = -1;
+            } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                // A moved directory is still watched where it went;
+                // whatever takes its place in PATH is watched anew
+                unwatch_dir(dir);
+                index_dir(dir, false);
+                path_dir_clear(dir);
+                dir->exists = false;
+                changed = true;
+            } else if (event->len > 0 && refresh_entry(dir, event->name)) {
+                changed = true;
+            }
+            cache.events_applied++;
+        }
+    }
+    return changed;
+}
+
+// Pick up PATH changes made from the shell. Directories that stay in
+// PATH keep their listing and watch; only new ones are read. Called
+// after every command, which is also when directories that have
+// appeared since (an installer creating ~/.local/bin) get watched.
+bool command_cache_sync_path(void) {
+    const char *path = getenv("PATH");
+    if (!path) path = "";
+    if (cache.path && strcmp(cache.path, path) == 0) {
+        // Events first: a directory the command removed has lost its watch
+        bool changed = command_cache_process_events();
+        for (size_t i = 0; i < cache.dirs_count; i++) {
+            if (revive_dir(&cache.dirs[i])) changed = true;
+        }
+        return changed;
+    }
+
+    size_t count;
+    PathDir *dirs = collect_path_dirs(path, &count);
+
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < cache.dirs_count; j++) {
+            PathDir *old = &cache.dirs[j];
+            if (old->path && strcmp(old->path, dirs[i].path) == 0) {
+                free(dirs[i].path);
+                dirs[i] = *old;
+                old->path = NULL;
+                break;
+            }
+        }
+    }
+
+    for (size_t j = 0; j < cache.dirs_count; j++) {
+        PathDir *old = &cache.dirs[j];
+        if (!old->path) continue;
+        index_dir(old, false);
+        unwatch_dir(old);
+        path_dir_clear(old);
+        free(old->path);
+    }
+    free(cache.dirs);
+
+    bool *fresh = calloc(count ? count : 1, sizeof(bool));
+    if (!fresh) die("calloc");
+    for (size_t i = 0; i < count; i++) {
+        fresh[i] = !dirs[i].listed;
+        if (fresh[i]) stat_path_dir(&dirs[i]);
+    }
+    scan_dirs(dirs, count);
+    for (size_t i = 0; i < count; i++) {
+        if (!fresh[i]) continue;
+        index_dir(&dirs[i], true);
+        watch_dir(&dirs[i]);
+        cache.dirs_scanned++;
+    }
+    free(fresh);
+
+    cache.dirs = dirs;
+    cache.dirs_count = count;
+    free(cache.path);
+    cache.path = strdup(path);
+    return true;
+}
+
+// Initialize command cache on startup
+void init_command_cache(void) {
+    free_command_cache();
+
+    long long start = now_ns();
+
+    char* path = getenv("PATH");
+    if (!path) path = "";
+    cache.path = strdup(path);
+    cache.dirs = collect_path_dirs(path, &cache.dirs_count);
+    for (size_t i = 0; i < cache.dirs_count; i++) {
+        stat_path_dir(&cache.dirs[i]);
+    }
+
+    char *file = cache_file_path();
+    if (!file || !load_cache_file(file)) {
+        scan_dirs(cache.dirs, cache.dirs_count);
+        for (size_t i = 0; i < cache.dirs_count; i++) {
+            if (!cache.dirs[i].loaded) cache.dirs_scanned++;
+        }
+
+        // Merge the listings into one index
+        grow_slots();
+        store_name("", 0);
+        for (size_t i = 0; i < cache.dirs_count; i++) {
+            index_dir(&cache.dirs[i], true);
+        }
+        build_sorted();
+
+        if (file) save_cache_file(file);
+    }
+    free(file);
+
+    cache.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    for (size_t i = 0; i < cache.dirs_count; i++) {
+        watch_dir(&cache.dirs[i]);
+    }
+    cache.scan_ns = now_ns() - start;
+}
+
+void command_cache_print_stats(void) {
+    printf("command cache: %zu commands from %zu directories (%zu rescanned), "
+           "loaded in %.3f ms%s\n",
+           cache.count, cache.dirs_count, cache.dirs_scanned, cache.scan_ns / 1e6,
+           cache.mapped ? " from the cache file" : "");
+    printf("command cache: %zu file system events applied\n", cache.events_applied);
+}
+
+void free_command_cache(void) {
+    for (size_t i = 0; i < cache.dirs_count; i++) {
+        free(cache.dirs[i].path);
+        if (!cache.dirs[i].loaded) free(cache.dirs[i].names);
+    }
+    free(cache.dirs);
+    free(cache.path);
+    if (cache.inotify_fd != -1) close(cache.inotify_fd);
+    if (!cache.mapped) {
+        free(cache.names);
+        free(cache.slots);
+        free(cache.sorted);
+    }
+    if (cache.map) munmap(cache.map, cache.map_size);
+    memset(&cache, 0, sizeof(cache));
+    cache.inotify_fd = -1;
+}
+
+bool command_cache_contains(const char *name, size_t len) {
+    if (!cache.slots || len == 0) return false;
+    return find_slot(name, len, hash_bytes(name, len))->offset != 0;
+}
+
+bool is_valid_partial_command(const char* partial) {
+    if (!partial || !*partial) return false;
+    return command_cache_contains(partial, strlen(partial));
+}
+
+// Index of the first sorted name that is not less than prefix
+static size_t lower_bound(const char *prefix, size_t len) {
+    size_t lo = 0, hi = cache.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const char *name = cache.names + cache.sorted[mid];
+        int cmp = strncmp(name, prefix, len);
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+size_t command_cache_prefix_range(const char *prefix, size_t len, size_t *first) {
+    *first = 0;
+    if (!cache.slots) return 0;
+    build_sorted();
+
+    size_t start = lower_bound(prefix, len);
+
+    // Names sharing the prefix compare equal under strncmp, so the
+    // range ends at the first name that compares greater
+    size_t lo = start, hi = cache.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(cache.names + cache.sorted[mid], prefix, len) == 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    *first = start;
+    return lo - start;
+}
+
+bool command_cache_has_prefix(const char *prefix, size_t len) {
+    if (!cache.slots) return false;
+    build_sorted();
+
+    size_t i = lower_bound(prefix, len);
+    return i < cache.count
+        && strncmp(cache.names + cache.sorted[i], prefix, len) == 0;
+}
+
+CommandState command_cache_classify(const char *word, size_t len) {
+    if (len == 0) return COMMAND_UNKNOWN;
+    if (command_cache_contains(word, len)) return COMMAND_VALID;
+    if (command_cache_has_prefix(word, len)) return COMMAND_PARTIAL;
+    return COMMAND_UNKNOWN;
+}
+
+const char *command_cache_sorted_name(size_t i) {
+    build_sorted();
+    return i < cache.count ? cache.names + cache.sorted[i] : NULL;
+}
+
+size_t command_cache_count(void) {
+    return cache.count;
+}
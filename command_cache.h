@@ -0,0 +1,36 @@
+#ifndef COMMAND_CACHE_H
+#define COMMAND_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// How the first word of the line relates to the commands in PATH
+typedef enum {
+    COMMAND_UNKNOWN,  // Nothing in PATH starts with it
+    COMMAND_PARTIAL,  // It is a prefix of at least one command
+    COMMAND_VALID,    // It is exactly a command
+} CommandState;
+
+void init_command_cache(void);
+void free_command_cache(void);
+void command_cache_print_stats(void);
+
+// Live refresh: poll the fd from the input loop and call
+// command_cache_process_events() when it is readable. Both return
+// true when the set of commands changed.
+int command_cache_watch_fd(void);
+bool command_cache_process_events(void);
+bool command_cache_sync_path(void);
+
+bool is_valid_partial_command(const char* partial);
+bool command_cache_contains(const char *name, size_t len);
+bool command_cache_has_prefix(const char *prefix, size_t len);
+CommandState command_cache_classify(const char *word, size_t len);
+
+// Sorted view, for completion: names in [*first, *first + count)
+// all start with prefix
+size_t command_cache_prefix_range(const char *prefix, size_t len, size_t *first);
+const char *command_cache_sorted_name(size_t i);
+size_t command_cache_count(void);
+
+#endif
@@ -1,71 +1,153 @@
+#define _GNU_SOURCE
 #include "completion.h"
 #include "prompt.h"
 #include "ansi_codes.h"
+#include "bash_worker.h"
+#include "native_completion.h"
+#include "completion_cache.h"
+#include "fuzzy.h"
+#include "menu.h"
+#include <limits.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 void free_completion_list(CompletionList *list) {
-    for (int i = 0; i < list->count; i++) {
-        free(list->items[i]);
+    free(list->arena);
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+// Room for at least min more arena bytes; *room is how much there is
+char *completion_list_space(CompletionList *list, size_t min, size_t *room) {
+    if (list->arena_capacity - list->arena_len < min) {
+        size_t capacity = list->arena_capacity ? list->arena_capacity : 4096;
+        while (capacity - list->arena_len < min) capacity *= 2;
+        char *arena = realloc(list->arena, capacity);
+        if (!arena) die("realloc");
+        list->arena = arena;
+        list->arena_capacity = capacity;
     }
-    list->count = 0;
+    if (room) *room = list->arena_capacity - list->arena_len;
+    return list->arena + list->arena_len;
 }
 
-CompletionList get_bash_completions(const char *line, int point) {
-    CompletionList completions = {0};
-    char command[1024];
-    
-    // Create a temporary file to store completions
-    char temp_file[] = "/tmp/completion_XXXXXX";
-    int fd = mkstemp(temp_file);
-    if (fd == -1) return completions;
-    close(fd);
-
-    // Prepare the completion command
-    // This complex command:
-    // 1. Sources bash completion scripts
-    // 2. Sets up completion environment
-    // 3. Gets completions for current command line
-    snprintf(command, sizeof(command),
-             "bash -c '\n"
-             "source /usr/share/bash-completion/bash_completion 2>/dev/null\n"
-             "COMP_LINE=\"%s\"\n"
-             "COMP_POINT=%d\n"
-             "COMP_TYPE=9\n" // TAB completion type
-             "_completion_loader \"${COMP_LINE%% *}\" 2>/dev/null\n"
-             "$(complete -p \"${COMP_LINE%% *}\" 2>/dev/null | sed \"s/.*-F \\([^ ]*\\).*/\\1/\") 2>/dev/null\n"
-             "if [ -n \"${COMPREPLY[*]}\" ]; then\n"
-             "  printf \"%%s\\n\" \"${COMPREPLY[@]}\"\n"
-             "else\n"
-             "  compgen -o default -- \"${COMP_LINE##* }\" 2>/dev/null\n"
-             "fi' > %s", 
-             line, point, temp_file);
-
-    // Execute the completion command
-    system(command);
-
-    // Read completions from temporary file
-    FILE *fp = fopen(temp_file, "r");
-    if (fp) {
-        char buffer[COMPLETION_MAX_LENGTH];
-        while (fgets(buffer, sizeof(buffer), fp) && completions.count < MAX_COMPLETIONS) {
-            // Remove newline
-            size_t len = strlen(buffer);
-            if (len > 0 && buffer[len-1] == '\n') {
-                buffer[len-1] = '\0';
-            }
-            
-            completions.items[completions.count] = strdup(buffer);
-            completions.count++;
-        }
-        fclose(fp);
+static void push_item(CompletionList *list, size_t offset, size_t len) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items = realloc(list->items, list->capacity * sizeof(CompletionItem));
+        if (!list->items) die("realloc");
+    }
+    list->items[list->count++] = (CompletionItem){ offset, len };
+}
+
+// Add to the item being built
+void completion_list_append(CompletionList *list, const char *text, size_t len) {
+    memcpy(completion_list_space(list, len + 1, NULL), text, len);
+    list->arena_len += len;
+}
+
+void completion_list_finish(CompletionList *list) {
+    completion_list_space(list, 1, NULL)[0] = '\0';
+    push_item(list, list->pending, list->arena_len - list->pending);
+    list->arena_len++;
+    list->pending = list->arena_len;
+}
+
+void completion_list_add(CompletionList *list, const char *item, size_t len) {
+    completion_list_append(list, item, len);
+    completion_list_finish(list);
+}
+
+// len bytes were written at completion_list_space(); every NUL among
+// them ends an item. Returns how many items that finished.
+int completion_list_ingest(CompletionList *list, size_t len) {
+    int before = list->count;
+    char *end = list->arena + list->arena_len + len;
+    char *p = list->arena + list->arena_len;
+    while ((p = memchr(p, '\0', end - p))) {
+        size_t nul = p - list->arena;
+        push_item(list, list->pending, nul - list->pending);
+        list->pending = nul + 1;
+        p++;
     }
+    list->arena_len += len;
+    return list->count - before;
+}
 
-    unlink(temp_file);
-    return completions;
+static int compare_items(const void *a, const void *b, void *arena) {
+    const CompletionItem *x = a, *y = b;
+    return strcmp((char *)arena + x->offset, (char *)arena + y->offset);
+}
+
+void completion_list_sort(CompletionList *list) {
+    qsort_r(list->items, list->count, sizeof(CompletionItem), compare_items, list->arena);
+}
+
+// Keep only the items pattern fuzzily matches, best first
+void completion_list_rank(CompletionList *list, const char *pattern, int pattern_len) {
+    if (list->count == 0) return;
+
+    FuzzyCandidate *candidates = malloc(list->count * sizeof(FuzzyCandidate));
+    FuzzyMatch *matches = malloc(list->count * sizeof(FuzzyMatch));
+    CompletionItem *items = malloc(list->count * sizeof(CompletionItem));
+    if (!candidates || !matches || !items) die("malloc");
+
+    for (int i = 0; i < list->count; i++) {
+        candidates[i] = (FuzzyCandidate){ completion_item(list, i), completion_item_len(list, i) };
+    }
+    int matched = fuzzy_rank(pattern, pattern_len, candidates, list->count, matches);
+    for (int i = 0; i < matched; i++) items[i] = list->items[matches[i].index];
+
+    memcpy(list->items, items, matched * sizeof(CompletionItem));
+    list->count = matched;
+    free(candidates);
+    free(matches);
+    free(items);
+}
+
+#define DEFAULT_DEADLINE_MS 150
+#define WORKER_TIMEOUT_MS 5000
+
+// The bash request whose answer we still want. It goes stale, and its
+// answer is dropped, as soon as the line or point moves on.
+static struct {
+    unsigned id;  // 0 when nothing is wanted
+    unsigned next_id;
+    char *line;
+    char cwd[PATH_MAX];
+    int point;
+    unsigned version;
+    long long deadline;  // Partial results are shown from here on
+    bool partial_shown;
+    bool sent;
+    bool restarted;  // The worker already died on it once
+    long long sent_at;
+} request;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// How long bash gets before native path candidates are shown instead
+static int deadline_ms(void) {
+    const char *value = getenv("SHELL_COMPLETION_DEADLINE_MS");
+    return value && *value ? atoi(value) : DEFAULT_DEADLINE_MS;
+}
+
+static void drop_request(void) {
+    free(request.line);
+    request.line = NULL;
+    request.id = 0;
+}
+
+static bool request_is_stale(const Line *line) {
+    return request.version != line->version || request.point != line->point;
 }
 
 int find_word_start(const char *line, int point) {
@@ -76,100 +158,183 @@ int find_word_start(const char *line, int point) {
     return i;
 }
 
-void apply_completion(Line *line, const char *completion) {
-    int word_start = find_word_start(line->buffer, line->point);
-    
-    // Calculate the part of the word we're completing
-    int word_len = line->point - word_start;
-    int completion_len = strlen(completion);
-    
-    // Make sure we have enough space
-    if (line->length - word_len + completion_len >= LINE_MAX - 1) {
-        return;
-    }
-    
-    // Remove the current partial word
-    memmove(line->buffer + word_start, 
-            line->buffer + line->point,
-            line->length - line->point);
-    line->length -= word_len;
+void apply_completion(Line *line, const char *completion, size_t len) {
+    int word_start = find_word_start(line_text(line), line->point);
     
-    // Insert the completion
-    memmove(line->buffer + word_start + completion_len,
-            line->buffer + word_start,
-            line->length - word_start);
-    memcpy(line->buffer + word_start, completion, completion_len);
-    
-    line->length += completion_len;
-    line->point = word_start + completion_len;
-    line->buffer[line->length] = '\0';
+    // Replace the current partial word with the completion
+    line_delete(line, word_start, line->point);
+    line_insert(line, completion, len);
 }
 
-char *find_common_prefix(CompletionList *completions) {
-    if (completions->count == 0) return NULL;
+// Length of the prefix all candidates share
+size_t find_common_prefix(const CompletionList *completions) {
+    if (completions->count == 0) return 0;
     
-    char *prefix = strdup(completions->items[0]);
-    int prefix_len = strlen(prefix);
+    const char *first = completion_item(completions, 0);
+    size_t prefix_len = completion_item_len(completions, 0);
     
-    for (int i = 1; i < completions->count; i++) {
-        int j;
-        for (j = 0; j < prefix_len; j++) {
-            if (prefix[j] != completions->items[i][j]) {
-                prefix[j] = '\0';
+    for (int i = 1; i < completions->count && prefix_len > 0; i++) {
+        const char *item = completion_item(completions, i);
+        size_t len = completion_item_len(completions, i);
+        if (len < prefix_len) prefix_len = len;
+        for (size_t j = 0; j < prefix_len; j++) {
+            if (first[j] != item[j]) {
                 prefix_len = j;
                 break;
             }
         }
     }
     
-    return prefix;
+    return prefix_len;
 }
 
-void handle_completion(Line *line) {
-    CompletionList completions = get_bash_completions(line->buffer, line->point);
-    
-    if (completions.count == 0) {
+static void present_completions(Line *line, CompletionList *completions) {
+    if (completions->count == 0) {
         // No completions available
         return;
-    } else if (completions.count == 1) {
+    }
+
+    // An answer that arrives late replaces the menu of native paths shown
+    // while waiting; that menu's word range is about to go stale
+    menu_close();
+    if (completions->count == 1) {
         // Single completion - apply it directly
-        apply_completion(line, completions.items[0]);
+        apply_completion(line, completion_item(completions, 0), completion_item_len(completions, 0));
     } else {
         // Multiple completions
-        // First try to apply common prefix
-        char *common_prefix = find_common_prefix(&completions);
-        if (common_prefix && strlen(common_prefix) > 0) {
-            apply_completion(line, common_prefix);
-            free(common_prefix);
+        // First try to apply common prefix, if it extends the word; ranked
+        // fuzzy matches need not start with it
+        const char *text = line_text(line);
+        int word_start = find_word_start(text, line->point);
+        size_t word_len = line->point - word_start;
+        size_t prefix_len = find_common_prefix(completions);
+        if (prefix_len > word_len
+            && memcmp(completion_item(completions, 0), text + word_start, word_len) == 0) {
+            apply_completion(line, completion_item(completions, 0), prefix_len);
         }
         
-        // Display all possible completions
-        printf("\n");
-        int max_length = 0;
-        for (int i = 0; i < completions.count; i++) {
-            int len = strlen(completions.items[i]);
-            if (len > max_length) max_length = len;
+        // Let the user pick from the rest
+        menu_open(line, completions);
+    }
+}
+
+// The paths we can find ourselves, for while bash is late or when it
+// is not there at all
+static bool show_native_paths(Line *line) {
+    if (request.partial_shown || request_is_stale(line)) return false;
+    request.partial_shown = true;
+    CompletionList completions = {0};
+    native_complete_paths(request.line, request.point, request.cwd, &completions);
+    bool shown = completions.count > 0;
+    if (shown) menu_open(line, &completions);
+    free_completion_list(&completions);
+    return shown;
+}
+
+static void send_request(void) {
+    if (request.id == 0 || request.sent || bash_worker_busy()) return;
+    request.sent = bash_worker_send(request.id, request.cwd, request.line, request.point);
+    request.sent_at = now_ms();
+    if (!request.sent) drop_request();
+}
+
+// Native completion answers at once. Otherwise bash is asked in the
+// background and the answer is presented when it arrives, if the line
+// has not changed by then.
+void handle_completion(Line *line) {
+    CompletionList completions = {0};
+    const char *text = line_text(line);
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) strcpy(cwd, "/");
+
+    CompletionKey key;
+    completion_key_init(&key, text, line->point, cwd);
+    if (native_complete(text, line->point, cwd, &completions)
+        || completion_cache_lookup(&key, NULL, &completions)) {
+        present_completions(line, &completions);
+        free_completion_list(&completions);
+        return;
+    }
+
+    drop_request();
+    request.id = ++request.next_id;
+    if (request.id == 0) request.id = ++request.next_id;
+    request.line = strdup(text);
+    strcpy(request.cwd, cwd);
+    request.point = line->point;
+    request.version = line->version;
+    request.deadline = now_ms() + deadline_ms();
+    request.partial_shown = false;
+    request.sent = false;
+    request.restarted = false;
+    send_request();
+}
+
+int completion_watch_fd(void) {
+    return bash_worker_fd();
+}
+
+bool completion_process_response(Line *line) {
+    CompletionList completions = {0};
+    unsigned id;
+    bool changed = false;
+
+    if (bash_worker_receive(&id, &completions)) {
+        if (request.id != 0 && id == request.id) {
+            CompletionKey key;
+            completion_key_init(&key, request.line, request.point, request.cwd);
+            completion_cache_store(&key, NULL, &completions);
+            if (!request_is_stale(line)) {
+                present_completions(line, &completions);
+                changed = true;
+            }
         }
-        
-        // Calculate number of columns based on terminal width
-        struct winsize ws;
-        ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
-        int cols = ws.ws_col / (max_length + 2);
-        if (cols == 0) cols = 1;
-        
-        // Print completions in columns
-        for (int i = 0; i < completions.count; i++) {
-            printf("%-*s%s", max_length + 2, completions.items[i],
-                   (i + 1) % cols == 0 ? "\n" : "");
+        if (id == request.id) drop_request();
+        free_completion_list(&completions);
+    }
+
+    // The worker died and lost our request. It gets one restart; if bash
+    // cannot even start, only the candidates we find ourselves are left.
+    if (request.id != 0 && request.sent && !bash_worker_busy()) {
+        if (request.restarted) {
+            changed = show_native_paths(line) || changed;
+            drop_request();
+        } else {
+            request.restarted = true;
+            request.sent = false;
         }
-        if (completions.count % cols != 0) printf("\n");
     }
-    
-    // Redraw prompt and line
-    draw_prompt(status);
-    printf("%s", line->buffer);
-    int pos = line->length - line->point;
-    while (pos-- > 0) printf(CURSOR_LEFT);
-    
-    free_completion_list(&completions);
+    // The worker is free again
+    if (request.id != 0 && !bash_worker_busy()) send_request();
+    return changed;
+}
+
+int completion_timeout_ms(void) {
+    long long now = now_ms();
+    long long timeout = -1;
+    if (request.id != 0 && !request.partial_shown) timeout = request.deadline - now;
+    if (bash_worker_busy()) {
+        long long worker = request.sent_at + WORKER_TIMEOUT_MS - now;
+        if (timeout < 0 || worker < timeout) timeout = worker;
+    }
+    if (timeout == -1) return -1;
+    return timeout < 0 ? 0 : timeout;
+}
+
+bool completion_tick(Line *line) {
+    if (request.id != 0 && request_is_stale(line)) drop_request();
+
+    long long now = now_ms();
+
+    // A worker stuck on one request is replaced
+    if (bash_worker_busy() && now >= request.sent_at + WORKER_TIMEOUT_MS) {
+        bash_worker_stop();
+        if (request.id != 0) drop_request();
+        return false;
+    }
+
+    if (request.id == 0 || now < request.deadline) return false;
+
+    // Past the deadline: show the paths we can find ourselves meanwhile
+    return show_native_paths(line);
 }
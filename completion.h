@@ -2,21 +2,56 @@
 #define COMPLETION_H
 
 #include "line.h"
-#include <sys/ioctl.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-#define MAX_COMPLETIONS 1000
-#define COMPLETION_MAX_LENGTH 256
+// Candidates live back to back, NUL-terminated, in one arena; items
+// record where each starts and how long it is. Both grow as needed
+// and free_completion_list() releases everything at once.
+typedef struct {
+    size_t offset;
+    size_t len;
+} CompletionItem;
 
 typedef struct {
-    char *items[MAX_COMPLETIONS];
+    char *arena;
+    size_t arena_len;       // Bytes used, including an unfinished item
+    size_t arena_capacity;
+    size_t pending;         // Where the unfinished item starts
+    CompletionItem *items;
     int count;
+    int capacity;
 } CompletionList;
 
 void free_completion_list(CompletionList *list);
-CompletionList get_bash_completions(const char *line, int point);
+void completion_list_add(CompletionList *list, const char *item, size_t len);
+void completion_list_append(CompletionList *list, const char *text, size_t len);
+void completion_list_finish(CompletionList *list);
+char *completion_list_space(CompletionList *list, size_t min, size_t *room);
+int completion_list_ingest(CompletionList *list, size_t len);
+void completion_list_sort(CompletionList *list);
+void completion_list_rank(CompletionList *list, const char *pattern, int pattern_len);
+
+static inline const char *completion_item(const CompletionList *list, int i) {
+    return list->arena + list->items[i].offset;
+}
+
+static inline size_t completion_item_len(const CompletionList *list, int i) {
+    return list->items[i].len;
+}
+
 int find_word_start(const char *line, int point);
-void apply_completion(Line *line, const char *completion);
-char *find_common_prefix(CompletionList *completions);
+void apply_completion(Line *line, const char *completion, size_t len);
+size_t find_common_prefix(const CompletionList *completions);
 void handle_completion(Line *line);
 
+// Background requests: poll completion_watch_fd() from the input loop
+// with completion_timeout_ms(), then call completion_process_response()
+// when it is readable and completion_tick() on every wakeup. Both
+// return true when the line or screen changed.
+int completion_watch_fd(void);
+bool completion_process_response(Line *line);
+int completion_timeout_ms(void);
+bool completion_tick(Line *line);
+
 #endif
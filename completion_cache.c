@@ -0,0 +1,170 @@
+#include "completion_cache.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define COMPLETION_CACHE_SIZE 32
+#define COMPLETION_CACHE_TTL_MS 30000
+
+typedef struct {
+    char *command;
+    int arg_index;
+    char *cwd;
+    char *prefix;
+    int prefix_len;
+
+    char *dir;                  // NULL for bash results
+    struct timespec dir_mtime;
+    long long expires;          // For bash results
+
+    CompletionList candidates;
+    unsigned long last_used;    // 0 for a free entry
+} CacheEntry;
+
+static struct {
+    CacheEntry entries[COMPLETION_CACHE_SIZE];
+    unsigned long clock;
+    unsigned long hits;
+    unsigned long narrowed;
+    unsigned long misses;
+} cache;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void completion_key_init(CompletionKey *key, const char *line, int point, const char *cwd) {
+    int word_start = find_word_start(line, point);
+
+    int i = 0;
+    while (i < word_start && isspace((unsigned char)line[i])) i++;
+    key->command = line + i;
+    key->command_len = 0;
+    key->arg_index = 0;
+    while (i < word_start) {
+        int start = i;
+        while (i < word_start && !isspace((unsigned char)line[i])) i++;
+        if (key->arg_index == 0) key->command_len = i - start;
+        key->arg_index++;
+        while (i < word_start && isspace((unsigned char)line[i])) i++;
+    }
+
+    key->cwd = cwd;
+    key->prefix = line + word_start;
+    key->prefix_len = point - word_start;
+}
+
+static void free_entry(CacheEntry *entry) {
+    free(entry->command);
+    free(entry->cwd);
+    free(entry->prefix);
+    free(entry->dir);
+    free_completion_list(&entry->candidates);
+    memset(entry, 0, sizeof(*entry));
+}
+
+static bool entry_is_fresh(CacheEntry *entry) {
+    if (!entry->dir) return now_ms() < entry->expires;
+
+    struct stat st;
+    return stat(entry->dir, &st) == 0
+        && st.st_mtim.tv_sec == entry->dir_mtime.tv_sec
+        && st.st_mtim.tv_nsec == entry->dir_mtime.tv_nsec;
+}
+
+static bool entry_matches(const CacheEntry *entry, const CompletionKey *key, const char *dir) {
+    return entry->last_used
+        && entry->arg_index == key->arg_index
+        && (int)strlen(entry->command) == key->command_len
+        && memcmp(entry->command, key->command, key->command_len) == 0
+        && strcmp(entry->cwd, key->cwd) == 0
+        && (dir ? entry->dir && strcmp(entry->dir, dir) == 0 : !entry->dir);
+}
+
+// The cached prefix is the start of ours, and the rest adds no directory
+static bool narrows(const CacheEntry *entry, const CompletionKey *key) {
+    return entry->prefix_len <= key->prefix_len
+        && memcmp(entry->prefix, key->prefix, entry->prefix_len) == 0
+        && !memchr(key->prefix + entry->prefix_len, '/', key->prefix_len - entry->prefix_len);
+}
+
+bool completion_cache_lookup(const CompletionKey *key, const char *dir,
+                             CompletionList *completions) {
+    // Prefer the longest cached prefix: it has the fewest candidates to filter
+    CacheEntry *best = NULL;
+    for (int i = 0; i < COMPLETION_CACHE_SIZE; i++) {
+        CacheEntry *entry = &cache.entries[i];
+        if (!entry_matches(entry, key, dir) || !narrows(entry, key)) continue;
+        if (!entry_is_fresh(entry)) {
+            free_entry(entry);
+            continue;
+        }
+        if (!best || entry->prefix_len > best->prefix_len) best = entry;
+    }
+    if (!best) {
+        cache.misses++;
+        return false;
+    }
+
+    best->last_used = ++cache.clock;
+    bool exact = best->prefix_len == key->prefix_len;
+    if (exact) cache.hits++;
+    else cache.narrowed++;
+
+    const CompletionList *candidates = &best->candidates;
+    for (int i = 0; i < candidates->count; i++) {
+        const char *name = completion_item(candidates, i);
+        size_t len = completion_item_len(candidates, i);
+        if (exact || (len >= (size_t)key->prefix_len && memcmp(name, key->prefix, key->prefix_len) == 0)) {
+            completion_list_add(completions, name, len);
+        }
+    }
+    return true;
+}
+
+void completion_cache_store(const CompletionKey *key, const char *dir,
+                            const CompletionList *completions) {
+    // Replace the same key, else a free entry, else the least recently used
+    CacheEntry *slot = &cache.entries[0];
+    for (int i = 0; i < COMPLETION_CACHE_SIZE; i++) {
+        CacheEntry *entry = &cache.entries[i];
+        if (entry_matches(entry, key, dir) && entry->prefix_len == key->prefix_len
+            && memcmp(entry->prefix, key->prefix, key->prefix_len) == 0) {
+            slot = entry;
+            break;
+        }
+        if (entry->last_used < slot->last_used) slot = entry;
+    }
+    free_entry(slot);
+
+    if (dir) {
+        struct stat st;
+        if (stat(dir, &st) != 0) return;
+        slot->dir = strdup(dir);
+        slot->dir_mtime = st.st_mtim;
+    } else {
+        slot->expires = now_ms() + COMPLETION_CACHE_TTL_MS;
+    }
+
+    for (int i = 0; i < completions->count; i++) {
+        completion_list_add(&slot->candidates, completion_item(completions, i),
+                            completion_item_len(completions, i));
+    }
+
+    slot->command = strndup(key->command, key->command_len);
+    slot->arg_index = key->arg_index;
+    slot->cwd = strdup(key->cwd);
+    slot->prefix = strndup(key->prefix, key->prefix_len);
+    slot->prefix_len = key->prefix_len;
+    slot->last_used = ++cache.clock;
+}
+
+void completion_cache_print_stats(void) {
+    printf("completion cache: %lu hits, %lu narrowed, %lu misses\n",
+           cache.hits, cache.narrowed, cache.misses);
+}
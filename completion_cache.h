@@ -0,0 +1,32 @@
+#ifndef COMPLETION_CACHE_H
+#define COMPLETION_CACHE_H
+
+#include <stdbool.h>
+#include "completion.h"
+
+// Recent completion results, least recently used evicted first. A
+// lookup whose prefix extends a cached one (without crossing a '/') is
+// answered by filtering that entry's candidates. Path results are
+// dropped when their directory's mtime changes, bash results after a
+// fixed time.
+
+typedef struct {
+    const char *command;  // First word of the line
+    int command_len;
+    int arg_index;        // Words before the one being completed
+    const char *cwd;
+    const char *prefix;   // The word being completed, up to point
+    int prefix_len;
+} CompletionKey;
+
+void completion_key_init(CompletionKey *key, const char *line, int point, const char *cwd);
+
+// dir is the directory path candidates were read from, or NULL for
+// results from bash
+bool completion_cache_lookup(const CompletionKey *key, const char *dir,
+                             CompletionList *completions);
+void completion_cache_store(const CompletionKey *key, const char *dir,
+                            const CompletionList *completions);
+void completion_cache_print_stats(void);
+
+#endif
@@ -1,6 +1,7 @@
 #include "electric_pair_mode.h"
-
-// TODO implement forward_list() and backward_list()
+#include "line.h"
+#include <stdlib.h>
+#include <string.h>
 
 bool electric_pair_mode = true;
 
@@ -23,71 +24,199 @@ char get_matching_char(char c) {
     }
 }
 
-// TODO fix ( ( | ) ) when you thipe ')' this should happen ( (  )| ) not this ( (  ) )|
-int find_next_closing_delimiter(const char *buffer, int point, char c) {
-    char opening;
+bool is_matching_pair(char open, char close) {
+    return (open == '(' && close == ')')
+        || (open == '[' && close == ']')
+        || (open == '{' && close == '}')
+        || ((open == '"' && close == '"')
+            || (open == '\'' && close == '\''));
+}
+
+static int delim_kind(char c) {
     switch (c) {
-    case ')': opening = '('; break;
-    case ']': opening = '['; break;
-    case '}': opening = '{'; break;
-    case '"': 
-    case '\'': opening = c; break;
+    case '(': case ')': return DELIM_PAREN;
+    case '[': case ']': return DELIM_BRACKET;
+    case '{': case '}': return DELIM_BRACE;
+    case '"': return DELIM_DQUOTE;
+    case '\'': return DELIM_SQUOTE;
     default: return -1;
     }
-    
-    // For quotes, find the next quote
-    if (c == '"' || c == '\'') {
-        int count = 0;
-        // Count quotes before our position
-        for (int i = 0; i < point; i++) {
-            if (buffer[i] == c) count++;
+}
+
+static bool is_quote_kind(int kind) {
+    return kind == DELIM_DQUOTE || kind == DELIM_SQUOTE;
+}
+
+// How an entry changes its kind's running count
+static int depth_step(int kind, int entry) {
+    if (is_quote_kind(kind)) return 1;
+    return (entry & 1) ? -1 : 1;
+}
+
+static void list_reserve(DelimList *list) {
+    if (list->before + list->after < list->capacity) return;
+
+    int capacity = list->capacity ? list->capacity * 2 : 16;
+    int *entries = malloc(capacity * sizeof(int));
+    if (!entries) die("malloc");
+    if (list->entries) {
+        memcpy(entries, list->entries, list->before * sizeof(int));
+        memcpy(entries + capacity - list->after,
+               list->entries + list->capacity - list->after,
+               list->after * sizeof(int));
+    }
+    free(list->entries);
+    list->entries = entries;
+    list->capacity = capacity;
+}
+
+void delim_insert(DelimIndex *index, int pos, char c) {
+    int kind = delim_kind(c);
+    if (kind < 0) return;
+
+    DelimList *list = &index->lists[kind];
+    int entry = pos << 1 | (!is_quote_kind(kind) && is_closing_delimiter(c));
+    list_reserve(list);
+    list->entries[list->before++] = entry;
+    index->depth[kind] += depth_step(kind, entry);
+}
+
+// Forget entries at or after start, all of which are before the gap
+void delim_truncate(DelimIndex *index, int start) {
+    for (int kind = 0; kind < DELIM_KINDS; kind++) {
+        DelimList *list = &index->lists[kind];
+        while (list->before > 0 && (list->entries[list->before - 1] >> 1) >= start) {
+            index->depth[kind] -= depth_step(kind, list->entries[--list->before]);
         }
-        // If we have an odd number before us, find the closing quote
-        if (count % 2 == 1) {
-            for (int i = point; buffer[i] != '\0'; i++) {
-                if (buffer[i] == c) return i;
+    }
+}
+
+// Only the entries between the old and new gap change sides
+void delim_move_gap(DelimIndex *index, int gap, int new_gap, int length) {
+    for (int kind = 0; kind < DELIM_KINDS; kind++) {
+        DelimList *list = &index->lists[kind];
+
+        if (new_gap < gap) {
+            while (list->before > 0 && (list->entries[list->before - 1] >> 1) >= new_gap) {
+                int entry = list->entries[--list->before];
+                index->depth[kind] -= depth_step(kind, entry);
+                int distance = length - (entry >> 1);
+                list->entries[list->capacity - ++list->after] = distance << 1 | (entry & 1);
+            }
+        } else if (new_gap > gap) {
+            while (list->after > 0) {
+                int entry = list->entries[list->capacity - list->after];
+                int pos = length - (entry >> 1);
+                if (pos >= new_gap) break;
+                list->after--;
+                list->entries[list->before++] = pos << 1 | (entry & 1);
+                index->depth[kind] += depth_step(kind, entry);
             }
         }
-        return -1;
     }
-    
-    // For brackets, find the nearest unclosed matching bracket
+}
+
+void delim_reset(DelimIndex *index) {
+    for (int kind = 0; kind < DELIM_KINDS; kind++) {
+        index->lists[kind].before = 0;
+        index->lists[kind].after = 0;
+        index->depth[kind] = 0;
+    }
+}
+
+// The i-th entry after the gap, nearest first
+static int after_entry(const DelimList *list, int i) {
+    return list->entries[list->capacity - list->after + i];
+}
+
+static int after_position(const DelimList *list, int i, int length) {
+    return length - (after_entry(list, i) >> 1);
+}
+
+bool inside_quotes(const DelimIndex *index, char quote) {
+    int kind = delim_kind(quote);
+    return kind >= 0 && index->depth[kind] % 2 == 1;
+}
+
+// Closer of the innermost unclosed opener before point, so typing ')'
+// in "( ( | ) )" lands after the inner one
+static int find_closer(const DelimList *list, int from, int length) {
     int depth = 0;
-    // Count depth before our position
-    for (int i = 0; i < point; i++) {
-        if (buffer[i] == opening) depth++;
-        else if (buffer[i] == c) depth--;
+    for (int i = from; i < list->after; i++) {
+        if (!(after_entry(list, i) & 1)) depth++;
+        else if (depth-- == 0) return after_position(list, i, length);
     }
-    
-    // If we're inside brackets, find the next matching close
-    if (depth > 0) {
-        for (int i = point; buffer[i] != '\0'; i++) {
-            if (buffer[i] == opening) depth++;
-            else if (buffer[i] == c) {
-                depth--;
-                if (depth == 0) return i;
-            }
+    return -1;
+}
+
+int find_next_closing_delimiter(const DelimIndex *index, int length, char c) {
+    int kind = delim_kind(c);
+    if (kind < 0) return -1;
+    const DelimList *list = &index->lists[kind];
+
+    // For quotes, the next quote closes the one we are in
+    if (is_quote_kind(kind)) {
+        if (index->depth[kind] % 2 == 1 && list->after > 0) {
+            return after_position(list, 0, length);
         }
+        return -1;
     }
-    return -1;
+
+    if (index->depth[kind] <= 0) return -1;
+    return find_closer(list, 0, length);
 }
 
-bool is_inside_delimiters(const char *buffer, int point) {
-    for (int i = 0; i < point; i++) {
-        if (is_opening_delimiter(buffer[i])) {
-            char matching = get_matching_char(buffer[i]);
-            int next_closer = find_next_closing_delimiter(buffer, i + 1, matching);
-            if (next_closer > point) return true;
+bool is_inside_delimiters(const DelimIndex *index) {
+    for (int kind = 0; kind < DELIM_KINDS; kind++) {
+        if (is_quote_kind(kind) ? index->depth[kind] % 2 == 1 : index->depth[kind] > 0) {
+            return true;
         }
     }
     return false;
 }
 
-bool is_matching_pair(char open, char close) {
-    return (open == '(' && close == ')')
-        || (open == '[' && close == ']')
-        || (open == '{' && close == '}')
-        || ((open == '"' && close == '"')
-            || (open == '\'' && close == '\''));
+// Position just after the balanced group that starts at the next
+// bracket, or -1 when the next bracket closes the one we are in
+int forward_list_position(const DelimIndex *index, int length) {
+    int best_kind = -1;
+    int best_pos = length;
+    for (int kind = DELIM_PAREN; kind <= DELIM_BRACE; kind++) {
+        const DelimList *list = &index->lists[kind];
+        if (list->after > 0 && after_position(list, 0, length) < best_pos) {
+            best_pos = after_position(list, 0, length);
+            best_kind = kind;
+        }
+    }
+    if (best_kind < 0) return -1;
+
+    const DelimList *list = &index->lists[best_kind];
+    if (after_entry(list, 0) & 1) return -1;
+
+    int closer = find_closer(list, 1, length);
+    return closer < 0 ? -1 : closer + 1;
 }
 
+// Position of the opener of the balanced group that ends at the
+// previous bracket, or -1 when that bracket opens the one we are in
+int backward_list_position(const DelimIndex *index, int point) {
+    int best_kind = -1;
+    int best_pos = -1;
+    for (int kind = DELIM_PAREN; kind <= DELIM_BRACE; kind++) {
+        const DelimList *list = &index->lists[kind];
+        if (list->before > 0 && (list->entries[list->before - 1] >> 1) > best_pos) {
+            best_pos = list->entries[list->before - 1] >> 1;
+            best_kind = kind;
+        }
+    }
+    if (best_kind < 0 || best_pos >= point) return -1;
+
+    const DelimList *list = &index->lists[best_kind];
+    if (!(list->entries[list->before - 1] & 1)) return -1;
+
+    int depth = 0;
+    for (int i = list->before - 2; i >= 0; i--) {
+        if (list->entries[i] & 1) depth++;
+        else if (depth-- == 0) return list->entries[i] >> 1;
+    }
+    return -1;
+}
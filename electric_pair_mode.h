@@ -5,11 +5,44 @@
 
 extern bool electric_pair_mode;
 
+// Delimiter index.
+// Every delimiter in the line is recorded in a list for its kind.
+// The lists are split at the line's gap like the text itself: entries
+// before the gap hold their position, entries after it hold their
+// distance from the end of the line, so edits at the gap never touch
+// the rest. Running counts for the text before the gap answer "how
+// deep are we at point" in O(1).
+
+enum { DELIM_PAREN, DELIM_BRACKET, DELIM_BRACE, DELIM_DQUOTE, DELIM_SQUOTE, DELIM_KINDS };
+
+typedef struct {
+    int *entries;  // (position or distance) << 1 | is_closing
+    int before;    // entries[0, before)
+    int after;     // entries[capacity - after, capacity), nearest first
+    int capacity;
+} DelimList;
+
+typedef struct {
+    DelimList lists[DELIM_KINDS];
+    int depth[DELIM_KINDS];  // Before the gap: opens minus closes, or quote count
+} DelimIndex;
+
 bool is_opening_delimiter(char c);
 bool is_closing_delimiter(char c);
 char get_matching_char(char c);
-int find_next_closing_delimiter(const char *buffer, int point, char c);
-bool is_inside_delimiters(const char *buffer, int point);
 bool is_matching_pair(char open, char close);
 
+// Kept in step with the line's gap buffer
+void delim_insert(DelimIndex *index, int pos, char c);
+void delim_truncate(DelimIndex *index, int start);
+void delim_move_gap(DelimIndex *index, int gap, int new_gap, int length);
+void delim_reset(DelimIndex *index);
+
+// Queries about point; the gap must be at point
+bool inside_quotes(const DelimIndex *index, char quote);
+int find_next_closing_delimiter(const DelimIndex *index, int length, char c);
+bool is_inside_delimiters(const DelimIndex *index);
+int forward_list_position(const DelimIndex *index, int length);
+int backward_list_position(const DelimIndex *index, int point);
+
 #endif
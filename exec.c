@@ -0,0 +1,762 @@
+#define _GNU_SOURCE
+#include "exec.h"
+#include "builtin.h"
+#include "jobs.h"
+#include "line.h"
+#include "prompt.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <pwd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// Launch is the time until the parent can go on (fork() or
+// posix_spawn() returning); total runs until the line is done
+typedef struct {
+    unsigned long lines;
+    unsigned long processes;
+    long long launch_ns;
+    long long total_ns;
+} ExecStats;
+
+static struct {
+    ExecStats native;
+    ExecStats via_sh;
+} counters;
+
+// Commands found in PATH, remembered like sh's hash table until PATH
+// or the commands in it change. A session runs few distinct commands,
+// so a list does.
+typedef struct {
+    char *name;
+    char *path;
+    unsigned long hits;
+} Hashed;
+
+static struct {
+    Hashed *items;
+    int count;
+    int capacity;
+} hashed;
+
+// Redirected fds are moved above the ones a command can name with a
+// single digit, so they never collide with a target
+#define FIRST_PRIVATE_FD 10
+
+typedef struct {
+    char **items;
+    int count;
+    int capacity;
+} Words;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} Buffer;
+
+// The field being built. literal is the word as it will be passed on;
+// pattern is the same with quoted glob characters escaped, for glob().
+typedef struct {
+    Buffer literal;
+    Buffer pattern;
+    bool glob;     // Has an unquoted * ? or [
+    bool started;  // Quotes make an empty field count
+    Words *out;
+} Field;
+
+// dup2(source, target) in the child, or close(target) if source is -1
+typedef struct {
+    int target;
+    int source;
+    bool opened;  // source is ours to close afterwards
+} Redirection;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void words_push(Words *words, char *word) {
+    if (words->count + 1 >= words->capacity) {
+        words->capacity = words->capacity ? words->capacity * 2 : 8;
+        words->items = realloc(words->items, words->capacity * sizeof(char *));
+        if (!words->items) die("realloc");
+    }
+    words->items[words->count++] = word;
+    words->items[words->count] = NULL;
+}
+
+static void words_free(Words *words) {
+    for (int i = 0; i < words->count; i++) free(words->items[i]);
+    free(words->items);
+    *words = (Words){0};
+}
+
+static void buffer_putc(Buffer *buffer, char c) {
+    if (buffer->len + 2 > buffer->capacity) {
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 64;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if (!buffer->data) die("realloc");
+    }
+    buffer->data[buffer->len++] = c;
+    buffer->data[buffer->len] = '\0';
+}
+
+static void field_add(Field *field, char c, bool quoted) {
+    buffer_putc(&field->literal, c);
+    if (quoted && strchr("*?[\\", c)) buffer_putc(&field->pattern, '\\');
+    buffer_putc(&field->pattern, c);
+    field->started = true;
+}
+
+static void field_add_glob(Field *field, char c) {
+    field_add(field, c, false);
+    field->glob = true;
+}
+
+static void field_end(Field *field) {
+    if (!field->started) return;
+    bool matched = false;
+    if (field->glob) {
+        glob_t g;
+        if (glob(field->pattern.data, 0, NULL, &g) == 0) {
+            for (size_t i = 0; i < g.gl_pathc; i++) {
+                char *path = strdup(g.gl_pathv[i]);
+                if (!path) die("strdup");
+                words_push(field->out, path);
+            }
+            matched = true;
+        }
+        globfree(&g);
+    }
+    // A pattern that matches nothing is kept as written
+    if (!matched) {
+        char *word = strdup(field->literal.data ? field->literal.data : "");
+        if (!word) die("strdup");
+        words_push(field->out, word);
+    }
+    field->literal.len = field->pattern.len = 0;
+    field->glob = field->started = false;
+}
+
+// Unquoted values are split at blanks and globbed; quoted ones are not
+static void field_add_value(Field *field, const char *value, bool split) {
+    for (const char *p = value; *p; p++) {
+        if (!split) field_add(field, *p, true);
+        else if (*p == ' ' || *p == '\t' || *p == '\n') field_end(field);
+        else if (strchr("*?[", *p)) field_add_glob(field, *p);
+        else field_add(field, *p, false);
+    }
+}
+
+static bool is_name_char(char c) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+// The parser only lets $NAME, ${NAME}, $? and $$ through
+static int expand_dollar(const char *s, int i, int end, Field *field, bool split) {
+    int name = i + 1, name_end;
+    int next;
+    if (name < end && s[name] == '{') {
+        name++;
+        name_end = name;
+        while (name_end < end && s[name_end] != '}') name_end++;
+        next = name_end + 1;
+    } else if (name < end && (s[name] == '?' || s[name] == '$')) {
+        name_end = name + 1;
+        next = name_end;
+    } else {
+        name_end = name;
+        while (name_end < end && is_name_char(s[name_end])) name_end++;
+        next = name_end;
+    }
+    if (name_end == name) {
+        field_add(field, '$', true);
+        return i + 1;
+    }
+
+    char number[32];
+    const char *value;
+    if (s[name] == '?') {
+        snprintf(number, sizeof(number), "%d", status);
+        value = number;
+    } else if (s[name] == '$') {
+        snprintf(number, sizeof(number), "%d", (int)getpid());
+        value = number;
+    } else {
+        char *key = strndup(s + name, name_end - name);
+        if (!key) die("strndup");
+        value = getenv(key);
+        free(key);
+    }
+    if (value) field_add_value(field, value, split);
+    return next;
+}
+
+// ~ or ~user at the start of a word
+static int expand_tilde(const char *s, int i, int end, Field *field) {
+    int user_end = i + 1;
+    while (user_end < end && s[user_end] != '/') {
+        if (!is_name_char(s[user_end]) && s[user_end] != '-' && s[user_end] != '.') {
+            field_add(field, '~', true);
+            return i + 1;
+        }
+        user_end++;
+    }
+
+    const char *home;
+    if (user_end == i + 1) {
+        home = getenv("HOME");
+    } else {
+        char *user = strndup(s + i + 1, user_end - i - 1);
+        if (!user) die("strndup");
+        struct passwd *pw = getpwnam(user);
+        free(user);
+        home = pw ? pw->pw_dir : NULL;
+    }
+    if (!home) {
+        field_add(field, '~', true);
+        return i + 1;
+    }
+    field_add_value(field, home, false);
+    return user_end;
+}
+
+// Appends the fields word expands to. split is false for assignments and
+// redirection targets, which stay one field and are not globbed.
+static void expand_word(const Ast *ast, AstWord word, Words *out, bool split) {
+    const char *s = ast->text;
+    int end = word.end;
+    Field field = { .out = out };
+
+    int i = word.start;
+    if (i < end && s[i] == '~') i = expand_tilde(s, i, end, &field);
+    while (i < end) {
+        char c = s[i];
+        if (c == '\\') {
+            if (i + 1 < end) field_add(&field, s[i + 1], true);
+            i += 2;
+        } else if (c == '\'') {
+            field.started = true;
+            for (i++; s[i] != '\''; i++) field_add(&field, s[i], true);
+            i++;
+        } else if (c == '"') {
+            field.started = true;
+            for (i++; s[i] != '"';) {
+                if (s[i] == '\\' && strchr("$`\"\\", s[i + 1])) {
+                    field_add(&field, s[i + 1], true);
+                    i += 2;
+                } else if (s[i] == '$') {
+                    i = expand_dollar(s, i, end, &field, false);
+                } else {
+                    field_add(&field, s[i++], true);
+                }
+            }
+            i++;
+        } else if (c == '$') {
+            i = expand_dollar(s, i, end, &field, split);
+        } else if (split && strchr("*?[", c)) {
+            field_add_glob(&field, c);
+            i++;
+        } else {
+            field_add(&field, c, !split);
+            i++;
+        }
+    }
+    field_end(&field);
+    free(field.literal.data);
+    free(field.pattern.data);
+}
+
+static void expand_command(const Ast *ast, const AstNode *node, Words *assignments, Words *argv) {
+    for (int i = 0; i < node->word_count; i++) {
+        AstWord word = ast->words[node->first_word + i];
+        if (i < node->assignment_count) expand_word(ast, word, assignments, false);
+        else expand_word(ast, word, argv, true);
+    }
+}
+
+// Opens what the node's redirections name, in order. On failure the
+// ones already opened are closed again.
+static bool open_redirects(const Ast *ast, const AstNode *node, Redirection *out) {
+    for (int i = 0; i < node->redirect_count; i++) {
+        const AstRedirect *r = &ast->redirects[node->first_redirect + i];
+        Words target = {0};
+        expand_word(ast, r->target, &target, false);
+        const char *path = target.count == 1 ? target.items[0] : "";
+        out[i] = (Redirection){ r->fd, -1, false };
+
+        bool ok = true;
+        if (r->kind == REDIRECT_DUP) {
+            char *end;
+            long fd = strtol(path, &end, 10);
+            if (strcmp(path, "-") == 0) {
+                out[i].source = -1;
+            } else if (*path && !*end && fd >= 0 && fd < FIRST_PRIVATE_FD) {
+                out[i].source = fd;
+            } else {
+                fprintf(stderr, "%s: bad file descriptor\n", path);
+                ok = false;
+            }
+        } else {
+            int flags = r->kind == REDIRECT_INPUT ? O_RDONLY
+                      : r->kind == REDIRECT_OUTPUT ? O_WRONLY | O_CREAT | O_TRUNC
+                      : r->kind == REDIRECT_APPEND ? O_WRONLY | O_CREAT | O_APPEND
+                      : O_RDWR | O_CREAT;
+            int fd = open(path, flags | O_CLOEXEC, 0666);
+            if (fd != -1 && fd < FIRST_PRIVATE_FD) {
+                int moved = fcntl(fd, F_DUPFD_CLOEXEC, FIRST_PRIVATE_FD);
+                close(fd);
+                fd = moved;
+            }
+            if (fd == -1) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                ok = false;
+            }
+            out[i].source = fd;
+            out[i].opened = true;
+        }
+        words_free(&target);
+
+        if (!ok) {
+            for (int j = 0; j < i; j++) {
+                if (out[j].opened) close(out[j].source);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+static void close_redirects(Redirection *redirects, int count) {
+    for (int i = 0; i < count; i++) {
+        if (redirects[i].opened) close(redirects[i].source);
+    }
+}
+
+// In a forked child, where nothing has to be undone
+static void apply_redirects(const Redirection *redirects, int count) {
+    for (int i = 0; i < count; i++) {
+        if (redirects[i].source == -1) close(redirects[i].target);
+        else dup2(redirects[i].source, redirects[i].target);
+    }
+}
+
+char *exec_search_path(const char *name) {
+    const char *dirs = getenv("PATH");
+    if (!dirs) dirs = "";
+    for (const char *dir = dirs;;) {
+        const char *end = strchrnul(dir, ':');
+        char *path;
+        // An empty entry is the current directory
+        if (asprintf(&path, "%.*s/%s", end > dir ? (int)(end - dir) : 1,
+                     end > dir ? dir : ".", name) == -1) {
+            die("asprintf");
+        }
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0) return path;
+        free(path);
+        if (!*end) return NULL;
+        dir = end + 1;
+    }
+}
+
+static Hashed *hashed_entry(const char *name, bool add) {
+    for (int i = 0; i < hashed.count; i++) {
+        if (strcmp(hashed.items[i].name, name) == 0) return &hashed.items[i];
+    }
+    if (!add) return NULL;
+
+    char *path = exec_search_path(name);
+    if (!path) return NULL;
+    if (hashed.count == hashed.capacity) {
+        hashed.capacity = hashed.capacity ? hashed.capacity * 2 : 16;
+        hashed.items = realloc(hashed.items, hashed.capacity * sizeof(Hashed));
+        if (!hashed.items) die("realloc");
+    }
+    char *copy = strdup(name);
+    if (!copy) die("strdup");
+    hashed.items[hashed.count] = (Hashed){ copy, path, 0 };
+    return &hashed.items[hashed.count++];
+}
+
+const char *exec_hashed(const char *name) {
+    Hashed *entry = hashed_entry(name, false);
+    return entry ? entry->path : NULL;
+}
+
+const char *exec_hash(const char *name) {
+    Hashed *entry = hashed_entry(name, true);
+    return entry ? entry->path : NULL;
+}
+
+void exec_forget(void) {
+    for (int i = 0; i < hashed.count; i++) {
+        free(hashed.items[i].name);
+        free(hashed.items[i].path);
+    }
+    hashed.count = 0;
+}
+
+void exec_print_hashed(void) {
+    if (hashed.count == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+    printf("hits\tcommand\n");
+    for (int i = 0; i < hashed.count; i++) {
+        printf("%4lu\t%s\n", hashed.items[i].hits, hashed.items[i].path);
+    }
+}
+
+// Environment with a command's NAME=value prefixes applied
+static char **command_environment(Words *assignments) {
+    size_t count = 0;
+    while (environ[count]) count++;
+    char **env = malloc((count + assignments->count + 1) * sizeof(char *));
+    if (!env) die("malloc");
+    memcpy(env, environ, count * sizeof(char *));
+
+    for (int i = 0; i < assignments->count; i++) {
+        char *assignment = assignments->items[i];
+        size_t name_len = strchr(assignment, '=') - assignment + 1;
+        size_t j = 0;
+        while (j < count && strncmp(env[j], assignment, name_len) != 0) j++;
+        env[j] = assignment;
+        if (j == count) count++;
+    }
+    env[count] = NULL;
+    return env;
+}
+
+// A builtin sees its NAME=value prefixes in the shell's own environment.
+// The values they replace are kept in saved, to be put back afterwards.
+static void set_assignments(const Words *assignments, char **saved) {
+    for (int i = 0; i < assignments->count; i++) {
+        char *assignment = assignments->items[i];
+        char *equals = strchr(assignment, '=');
+        *equals = '\0';
+        const char *old = getenv(assignment);
+        saved[i] = old ? strdup(old) : NULL;
+        setenv(assignment, equals + 1, 1);
+        *equals = '=';
+    }
+}
+
+// Whether argv is an export of name, which keeps its value as in bash
+static bool exports(const Words *argv, const char *name, size_t len) {
+    if (argv->count == 0 || strcmp(argv->items[0], "export") != 0) return false;
+    for (int i = 1; i < argv->count; i++) {
+        const char *arg = argv->items[i];
+        if (strncmp(arg, name, len) == 0 && (arg[len] == '\0' || arg[len] == '=')) return true;
+    }
+    return false;
+}
+
+// In reverse, so a name given twice ends up with its first old value
+static void restore_assignments(const Words *assignments, char **saved, const Words *argv) {
+    for (int i = assignments->count - 1; i >= 0; i--) {
+        char *assignment = assignments->items[i];
+        size_t len = strchr(assignment, '=') - assignment;
+        if (!exports(argv, assignment, len)) {
+            assignment[len] = '\0';
+            if (saved[i]) setenv(assignment, saved[i], 1);
+            else unsetenv(assignment);
+            assignment[len] = '=';
+        }
+        free(saved[i]);
+    }
+}
+
+static int run_node(const Ast *ast, int node);
+
+// Runs a builtin in the shell, with its redirections in effect only
+// for its duration
+static int run_builtin_here(Words *argv, const Redirection *redirects, int count) {
+    int saved[count > 0 ? count : 1];
+    fflush(stdout);
+    for (int i = 0; i < count; i++) {
+        saved[i] = fcntl(redirects[i].target, F_DUPFD_CLOEXEC, FIRST_PRIVATE_FD);
+        if (redirects[i].source == -1) close(redirects[i].target);
+        else dup2(redirects[i].source, redirects[i].target);
+    }
+
+    int result = handle_builtin(argv->count, argv->items);
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = count - 1; i >= 0; i--) {
+        if (saved[i] == -1) {
+            close(redirects[i].target);
+        } else {
+            dup2(saved[i], redirects[i].target);
+            close(saved[i]);
+        }
+    }
+    return result;
+}
+
+static Job *node_job(const Ast *ast, int node, bool foreground) {
+    const AstNode *n = &ast->nodes[node];
+    return job_new(ast->text + n->start, n->end - n->start, foreground);
+}
+
+// Starts one process of job for a command, a subshell or (in the
+// background) a whole and-or list, reading from in and writing to out
+// (-1 leaves them alone). next is the read end of the pipe to the
+// stage after this one, which a forked child has to close. A command
+// comes with its words already expanded, and start() frees them.
+static void start(const Ast *ast, int node, Words assignments, Words argv,
+                  int in, int out, int next, Job *job) {
+    const AstNode *n = &ast->nodes[node];
+    Redirection redirects[n->redirect_count > 0 ? n->redirect_count : 1];
+    if (!open_redirects(ast, n, redirects)) {
+        words_free(&assignments);
+        words_free(&argv);
+        job_add(job, -1, 1);
+        return;
+    }
+
+    long long begin = now_ns();
+    pid_t pid = -1;
+    if (n->kind == NODE_COMMAND && argv.count > 0 && !is_builtin(argv.items[0])) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        if (in != -1) posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+        if (out != -1) posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+        for (int i = 0; i < n->redirect_count; i++) {
+            if (redirects[i].source == -1) {
+                posix_spawn_file_actions_addclose(&actions, redirects[i].target);
+            } else {
+                posix_spawn_file_actions_adddup2(&actions, redirects[i].source, redirects[i].target);
+            }
+        }
+
+        // Children start with nothing blocked, whatever the shell blocks
+        posix_spawnattr_t attr;
+        sigset_t none;
+        sigemptyset(&none);
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setsigmask(&attr, &none);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+        job_spawnattr(job, &attr);
+
+        // Found through the hash table rather than by posix_spawnp(),
+        // which tries an exec in every PATH directory before the right one
+        char **env = assignments.count ? command_environment(&assignments) : environ;
+        const char *name = argv.items[0];
+        Hashed *entry = strchr(name, '/') ? NULL : hashed_entry(name, true);
+        const char *path = strchr(name, '/') ? name : entry ? entry->path : NULL;
+        int error = path ? posix_spawn(&pid, path, &actions, &attr, argv.items, env) : ENOENT;
+        if (env != environ) free(env);
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+        if (entry && !error) entry->hits++;
+        // Removed since it was looked up: look again next time
+        if (entry && error == ENOENT) exec_forget();
+
+        if (error) {
+            if (!path) fprintf(stderr, "%s: command not found\n", name);
+            else fprintf(stderr, "%s: %s\n", name, strerror(error));
+            job_add(job, -1, error == ENOENT ? 127 : 126);
+        } else {
+            job_add(job, pid, 0);
+        }
+    } else {
+        // Subshells, builtins that are part of a pipeline or in the
+        // background, and background lists
+        fflush(stdout);
+        pid = fork();
+        if (pid == 0) {
+            job_child(job);
+            if (in != -1) dup2(in, STDIN_FILENO);
+            if (out != -1) dup2(out, STDOUT_FILENO);
+            // Nothing is exec'd here, so O_CLOEXEC does not close the
+            // pipes; a leftover write or read end would keep a neighbour
+            // from ever seeing EOF or SIGPIPE. Closed before the
+            // redirections, which may reuse the numbers.
+            if (in > STDERR_FILENO) close(in);
+            if (out > STDERR_FILENO) close(out);
+            if (next != -1) close(next);
+            apply_redirects(redirects, n->redirect_count);
+            close_redirects(redirects, n->redirect_count);
+            // The child's environment is its own; nothing to restore
+            char *saved[assignments.count > 0 ? assignments.count : 1];
+            set_assignments(&assignments, saved);
+            int status = n->kind == NODE_SUBSHELL ? run_node(ast, n->left)
+                       : n->kind != NODE_COMMAND ? run_node(ast, node)
+                       : argv.count > 0 ? handle_builtin(argv.count, argv.items) : 0;
+            fflush(stdout);
+            fflush(stderr);
+            _exit(status);
+        }
+        if (pid == -1) perror("fork");
+        job_add(job, pid, 1);
+    }
+    if (pid != -1) {
+        counters.native.processes++;
+        counters.native.launch_ns += now_ns() - begin;
+    }
+
+    close_redirects(redirects, n->redirect_count);
+    words_free(&assignments);
+    words_free(&argv);
+}
+
+static int run_command(const Ast *ast, int node) {
+    const AstNode *n = &ast->nodes[node];
+    Words assignments = {0}, argv = {0};
+    expand_command(ast, n, &assignments, &argv);
+
+    // Builtins change the shell itself, so they run here
+    if (argv.count == 0 || is_builtin(argv.items[0])) {
+        Redirection redirects[n->redirect_count > 0 ? n->redirect_count : 1];
+        int result = 1;
+        if (open_redirects(ast, n, redirects)) {
+            char *saved[assignments.count > 0 ? assignments.count : 1];
+            set_assignments(&assignments, saved);
+            result = argv.count ? run_builtin_here(&argv, redirects, n->redirect_count) : 0;
+            restore_assignments(&assignments, saved, &argv);
+            close_redirects(redirects, n->redirect_count);
+        }
+        words_free(&assignments);
+        words_free(&argv);
+        return result;
+    }
+
+    Job *job = node_job(ast, node, true);
+    start(ast, node, assignments, argv, -1, -1, -1, job);
+    return job_wait(job);
+}
+
+static void collect_stages(const Ast *ast, int node, int *stages, int *count) {
+    if (ast->nodes[node].kind == NODE_PIPE) {
+        collect_stages(ast, ast->nodes[node].left, stages, count);
+        collect_stages(ast, ast->nodes[node].right, stages, count);
+    } else {
+        stages[(*count)++] = node;
+    }
+}
+
+// One process per stage, all in one job; the status is the last
+// stage's. A background job is left running and reports 0.
+static int run_pipeline(const Ast *ast, int node, bool foreground) {
+    int stages[ast->node_count];
+    int count = 0;
+    collect_stages(ast, node, stages, &count);
+
+    Job *job = node_job(ast, node, foreground);
+    int in = -1;
+    for (int i = 0; i < count; i++) {
+        int pipe_fds[2] = { -1, -1 };
+        if (i + 1 < count && pipe2(pipe_fds, O_CLOEXEC) == -1) {
+            perror("pipe");
+            job_add(job, -1, 1);
+            break;
+        }
+        Words assignments = {0}, argv = {0};
+        const AstNode *stage = &ast->nodes[stages[i]];
+        if (stage->kind == NODE_COMMAND) expand_command(ast, stage, &assignments, &argv);
+        start(ast, stages[i], assignments, argv, in, pipe_fds[1], pipe_fds[0], job);
+        if (in != -1) close(in);
+        if (pipe_fds[1] != -1) close(pipe_fds[1]);
+        in = pipe_fds[0];
+    }
+    if (in != -1) close(in);
+
+    if (!foreground) {
+        job_background(job);
+        return 0;
+    }
+    return job_wait(job);
+}
+
+static int run_node(const Ast *ast, int node) {
+    const AstNode *n = &ast->nodes[node];
+    switch (n->kind) {
+    case NODE_COMMAND:
+        return run_command(ast, node);
+    case NODE_SUBSHELL:
+        return run_pipeline(ast, node, true);
+    case NODE_NOT:
+        return !run_node(ast, n->left);
+    case NODE_PIPE:
+        return run_pipeline(ast, node, true);
+    case NODE_AND:
+        status = run_node(ast, n->left);
+        return status == 0 ? run_node(ast, n->right) : status;
+    case NODE_OR:
+        status = run_node(ast, n->left);
+        return status != 0 ? run_node(ast, n->right) : status;
+    case NODE_SEQUENCE:
+        status = run_node(ast, n->left);
+        return run_node(ast, n->right);
+    case NODE_BACKGROUND:
+        return run_pipeline(ast, n->left, false);
+    }
+    return 1;
+}
+
+static int run_sh(const char *cmd) {
+    long long start = now_ns();
+    Job *job = job_new(cmd, strlen(cmd), true);
+    pid_t pid = fork();
+
+    if (pid == -1) {
+        perror("fork");
+        job_add(job, -1, 1);
+        return job_wait(job);
+    }
+
+    if (pid == 0) {  // Child process
+        job_child(job);
+        execlp("/bin/sh", "sh", "-c", cmd, NULL);
+        /* execlp("/bin/python3", "python3", "-c", cmd, NULL); */
+        /* execlp("/bin/nu", "nu", "-c", cmd, NULL); */
+        perror("execlp");
+        exit(1);
+    }
+    counters.via_sh.processes++;
+    counters.via_sh.launch_ns += now_ns() - start;
+
+    job_add(job, pid, 0);
+    int result = job_wait(job);
+    counters.via_sh.lines++;
+    counters.via_sh.total_ns += now_ns() - start;
+    return result;
+}
+
+int exec_ast(const Ast *ast) {
+    if (ast->error || ast->needs_sh) return run_sh(ast->text);
+    if (ast->root < 0) return status;
+
+    long long start = now_ns();
+    int result = run_node(ast, ast->root);
+    counters.native.lines++;
+    counters.native.total_ns += now_ns() - start;
+    return result;
+}
+
+static void print_exec_stats(const char *how, const ExecStats *s) {
+    printf("exec: %lu lines %s, %lu processes launched in %.1f us on average, "
+           "%.1f us per line\n", s->lines, how, s->processes,
+           s->processes ? s->launch_ns / 1e3 / s->processes : 0.0,
+           s->lines ? s->total_ns / 1e3 / s->lines : 0.0);
+}
+
+void exec_print_stats(void) {
+    print_exec_stats("run natively", &counters.native);
+    print_exec_stats("through /bin/sh", &counters.via_sh);
+}
@@ -0,0 +1,29 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include "parser.h"
+
+// Running command lines.
+// The executor walks the parsed line itself: it expands words ($NAME,
+// ${NAME}, $?, $$, ~, globs, quotes), opens redirections, connects
+// pipeline stages with pipes and launches each external command with
+// posix_spawn, which vforks. Builtins run in the shell unless they are
+// part of a pipeline; subshells and piped builtins get a fork().
+// Lines the parser marked needs_sh, or could not parse, are handed to
+// /bin/sh -c whole. Each pipeline runs as a job (see jobs.h).
+
+// Runs the line and waits for its foreground jobs; returns its exit status
+int exec_ast(const Ast *ast);
+void exec_print_stats(void);
+
+// Where a command runs from. exec_hash() remembers what it finds, and
+// so does running the command; exec_hashed() only asks the table, and
+// exec_search_path() only PATH (the result is the caller's to free).
+// exec_forget() empties the table, for when PATH or its contents change.
+const char *exec_hash(const char *name);
+const char *exec_hashed(const char *name);
+char *exec_search_path(const char *name);
+void exec_forget(void);
+void exec_print_hashed(void);
+
+#endif
@@ -0,0 +1,138 @@
+#include "frame.h"
+#include "line.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} Frame;
+
+typedef struct {
+    unsigned long frames;
+    unsigned long bytes;
+    unsigned long writes;
+    size_t last_bytes;
+    unsigned long last_writes;
+} FrameStats;
+
+static Frame frame = {0};
+static FrameStats stats = {0};
+
+// Terminal size, asked again only after SIGWINCH
+static volatile sig_atomic_t resized = 1;
+static struct winsize size;
+
+static void reserve(size_t extra) {
+    if (frame.len + extra <= frame.capacity) return;
+    size_t capacity = frame.capacity ? frame.capacity : 4096;
+    while (frame.len + extra > capacity) capacity *= 2;
+    frame.data = realloc(frame.data, capacity);
+    if (!frame.data) die("realloc");
+    frame.capacity = capacity;
+}
+
+void frame_append(const char *data, size_t len) {
+    reserve(len);
+    memcpy(frame.data + frame.len, data, len);
+    frame.len += len;
+}
+
+void frame_puts(const char *s) {
+    frame_append(s, strlen(s));
+}
+
+void frame_putc(char c) {
+    reserve(1);
+    frame.data[frame.len++] = c;
+}
+
+void frame_printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(frame.data ? frame.data + frame.len : NULL,
+                      frame.capacity - frame.len, fmt, args);
+    va_end(args);
+    if (n < 0) return;
+
+    if (frame.len + n + 1 > frame.capacity) {
+        reserve(n + 1);
+        va_start(args, fmt);
+        vsnprintf(frame.data + frame.len, frame.capacity - frame.len, fmt, args);
+        va_end(args);
+    }
+    frame.len += n;
+}
+
+void frame_flush(void) {
+    // Anything printed through stdio (builtins, errors) goes first
+    fflush(stdout);
+    if (frame.len == 0) return;
+
+    unsigned long writes = 0;
+    size_t done = 0;
+    while (done < frame.len) {
+        ssize_t n = write(STDOUT_FILENO, frame.data + done, frame.len - done);
+        writes++;
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        done += n;
+    }
+
+    stats.frames++;
+    stats.bytes += frame.len;
+    stats.writes += writes;
+    stats.last_bytes = frame.len;
+    stats.last_writes = writes;
+    frame.len = 0;
+}
+
+static void handle_winch(int sig) {
+    (void)sig;
+    resized = 1;
+}
+
+void frame_init(void) {
+    struct sigaction sa = {0};
+    sa.sa_handler = handle_winch;
+    sa.sa_flags = SA_RESTART;  // poll() still wakes up with EINTR
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+}
+
+static void update_size(void) {
+    if (!resized) return;
+    resized = 0;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == -1 || size.ws_col == 0) {
+        size.ws_col = 80;
+        size.ws_row = 24;
+    }
+}
+
+int frame_columns(void) {
+    update_size();
+    return size.ws_col;
+}
+
+int frame_rows(void) {
+    update_size();
+    return size.ws_row;
+}
+
+void frame_print_stats(void) {
+    printf("frames: %lu, %lu bytes in %lu writes (%.1f bytes and %.2f writes per frame, "
+           "last %zu bytes in %lu)\n",
+           stats.frames, stats.bytes, stats.writes,
+           stats.frames ? (double)stats.bytes / stats.frames : 0.0,
+           stats.frames ? (double)stats.writes / stats.frames : 0.0,
+           stats.last_bytes, stats.last_writes);
+}
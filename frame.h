@@ -0,0 +1,24 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Output frame buffer.
+// Everything the editor draws is collected here and sent with a
+// single write() when the current input batch has been handled.
+
+void frame_append(const char *data, size_t len);
+void frame_puts(const char *s);
+void frame_putc(char c);
+void frame_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void frame_flush(void);
+
+// Terminal size, cached until the next SIGWINCH
+void frame_init(void);
+int frame_columns(void);
+int frame_rows(void);
+
+void frame_print_stats(void);
+
+#endif
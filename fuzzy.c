@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include "fuzzy.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FUZZY_X86 1
+#endif
+
+#define SCORE_MATCH 16
+#define SCORE_GAP_START -3
+#define SCORE_GAP_EXTENSION -1
+#define BONUS_BOUNDARY (SCORE_MATCH / 2)
+#define BONUS_BOUNDARY_WHITE (BONUS_BOUNDARY + 2)
+#define BONUS_BOUNDARY_DELIMITER (BONUS_BOUNDARY + 1)
+#define BONUS_NON_WORD (SCORE_MATCH / 2)
+#define BONUS_CAMEL (BONUS_BOUNDARY + SCORE_GAP_EXTENSION)
+#define BONUS_CONSECUTIVE (-(SCORE_GAP_START + SCORE_GAP_EXTENSION))
+#define BONUS_FIRST_CHAR_MULTIPLIER 2
+
+typedef enum {
+    CHAR_WHITE,
+    CHAR_DELIMITER,
+    CHAR_NON_WORD,
+    CHAR_LOWER,
+    CHAR_UPPER,
+    CHAR_NUMBER,
+} CharClass;
+
+static CharClass char_class(char c) {
+    if (c >= 'a' && c <= 'z') return CHAR_LOWER;
+    if (c >= 'A' && c <= 'Z') return CHAR_UPPER;
+    if (c >= '0' && c <= '9') return CHAR_NUMBER;
+    if (c == ' ' || c == '\t' || c == '\n') return CHAR_WHITE;
+    if (c == '/' || c == ',' || c == ':' || c == ';' || c == '|') return CHAR_DELIMITER;
+    if ((unsigned char)c >= 0x80) return CHAR_LOWER;
+    return CHAR_NON_WORD;
+}
+
+static bool is_word(CharClass class) {
+    return class > CHAR_NON_WORD;
+}
+
+// Bonus for matching a character of class `class` right after one of `prev`
+static int bonus_for(CharClass prev, CharClass class) {
+    if (is_word(class)) {
+        if (prev == CHAR_WHITE) return BONUS_BOUNDARY_WHITE;
+        if (prev == CHAR_DELIMITER) return BONUS_BOUNDARY_DELIMITER;
+        if (prev == CHAR_NON_WORD) return BONUS_BOUNDARY;
+    }
+    if ((prev == CHAR_LOWER && class == CHAR_UPPER)
+        || (prev != CHAR_NUMBER && class == CHAR_NUMBER)) {
+        return BONUS_CAMEL;
+    }
+    if (class == CHAR_NON_WORD || class == CHAR_DELIMITER) return BONUS_NON_WORD;
+    if (class == CHAR_WHITE) return BONUS_BOUNDARY_WHITE;
+    return 0;
+}
+
+static char to_upper(char c) {
+    return c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+}
+
+static char to_lower(char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// First index in [from, len) holding a or b, or -1
+static int find_scalar(const char *text, int len, int from, char a, char b) {
+    for (int i = from; i < len; i++) {
+        if (text[i] == a || text[i] == b) return i;
+    }
+    return -1;
+}
+
+#ifdef FUZZY_X86
+__attribute__((target("sse2")))
+static int find_sse2(const char *text, int len, int from, char a, char b) {
+    __m128i va = _mm_set1_epi8(a);
+    __m128i vb = _mm_set1_epi8(b);
+    int i = from;
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return find_scalar(text, len, i, a, b);
+}
+
+__attribute__((target("avx2")))
+static int find_avx2(const char *text, int len, int from, char a, char b) {
+    __m256i va = _mm256_set1_epi8(a);
+    __m256i vb = _mm256_set1_epi8(b);
+    int i = from;
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb));
+        unsigned mask = _mm256_movemask_epi8(hits);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    // The tail stays in this function: jumping into the SSE2 version
+    // with the upper halves dirty costs more than the scan itself
+    for (; i < len; i++) {
+        if (text[i] == a || text[i] == b) return i;
+    }
+    return -1;
+}
+#endif
+
+typedef int (*FindFn)(const char *text, int len, int from, char a, char b);
+
+static FindFn find_fn(void) {
+    static FindFn fn;
+    if (fn) return fn;
+    fn = find_scalar;
+#ifdef FUZZY_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) fn = find_avx2;
+    else if (__builtin_cpu_supports("sse2")) fn = find_sse2;
+#endif
+    return fn;
+}
+
+static bool has_upper(const char *pattern, int len) {
+    for (int i = 0; i < len; i++) {
+        if (pattern[i] >= 'A' && pattern[i] <= 'Z') return true;
+    }
+    return false;
+}
+
+static bool char_matches(char c, char p, bool case_sensitive) {
+    return case_sensitive ? c == p : to_lower(c) == p;
+}
+
+static int score_with(FindFn find, const char *pattern, int pattern_len,
+                      const char *text, int text_len, bool case_sensitive) {
+    if (pattern_len == 0) return 0;
+
+    // Forward: the earliest end of a match. This is the prefilter, and
+    // what rejects most candidates, so it runs on whole vectors.
+    int end = -1;
+    for (int i = 0; i < pattern_len; i++) {
+        char p = pattern[i];
+        char alt = case_sensitive ? p : to_upper(p);
+        end = find(text, text_len, end + 1, p, alt);
+        if (end < 0) return -1;
+    }
+
+    // Backward from there: the latest start, for the tightest window
+    int start = end;
+    for (int i = pattern_len - 1; start >= 0; start--) {
+        if (char_matches(text[start], pattern[i], case_sensitive) && --i < 0) break;
+    }
+
+    int score = 0;
+    int consecutive = 0;
+    int first_bonus = 0;
+    bool in_gap = false;
+    int pattern_index = 0;
+    CharClass prev = start > 0 ? char_class(text[start - 1]) : CHAR_WHITE;
+    for (int i = start; i <= end; i++) {
+        CharClass class = char_class(text[i]);
+        if (pattern_index < pattern_len
+            && char_matches(text[i], pattern[pattern_index], case_sensitive)) {
+            int bonus = bonus_for(prev, class);
+            score += SCORE_MATCH;
+            if (consecutive == 0) {
+                first_bonus = bonus;
+            } else {
+                // A run keeps the bonus of the boundary it started at
+                if (bonus >= BONUS_BOUNDARY && bonus > first_bonus) first_bonus = bonus;
+                if (first_bonus > bonus) bonus = first_bonus;
+                if (BONUS_CONSECUTIVE > bonus) bonus = BONUS_CONSECUTIVE;
+            }
+            score += pattern_index == 0 ? bonus * BONUS_FIRST_CHAR_MULTIPLIER : bonus;
+            in_gap = false;
+            consecutive++;
+            pattern_index++;
+        } else {
+            score += in_gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+            in_gap = true;
+            consecutive = 0;
+            first_bonus = 0;
+        }
+        prev = class;
+    }
+    return score;
+}
+
+int fuzzy_score(const char *pattern, int pattern_len, const char *text, int text_len) {
+    return score_with(find_fn(), pattern, pattern_len, text, text_len,
+                      has_upper(pattern, pattern_len));
+}
+
+// Between equal scores, shorter candidates are the closer match
+static int compare_matches(const void *a, const void *b, void *candidates) {
+    const FuzzyMatch *x = a, *y = b;
+    if (x->score != y->score) return y->score - x->score;
+    const FuzzyCandidate *c = candidates;
+    if (c[x->index].len != c[y->index].len) return c[x->index].len - c[y->index].len;
+    return x->index - y->index;
+}
+
+int fuzzy_rank(const char *pattern, int pattern_len,
+               const FuzzyCandidate *candidates, int count, FuzzyMatch *matches) {
+    FindFn find = find_fn();
+    bool case_sensitive = has_upper(pattern, pattern_len);
+
+    int matched = 0;
+    for (int i = 0; i < count; i++) {
+        int score = score_with(find, pattern, pattern_len,
+                               candidates[i].text, candidates[i].len, case_sensitive);
+        if (score < 0) continue;
+        matches[matched++] = (FuzzyMatch){ i, score };
+    }
+
+    qsort_r(matches, matched, sizeof(FuzzyMatch), compare_matches, (void *)candidates);
+    return matched;
+}
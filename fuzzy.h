@@ -0,0 +1,30 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include <stdbool.h>
+
+// Subsequence matching scored the way fzf does it: matched characters
+// earn points, more at word boundaries, camelCase humps and in runs,
+// and gaps between them cost. A lowercase pattern matches either case;
+// any uppercase letter makes it case sensitive.
+
+typedef struct {
+    const char *text;
+    int len;
+} FuzzyCandidate;
+
+typedef struct {
+    int index;  // Into the candidates
+    int score;
+} FuzzyMatch;
+
+// Score of the best window of text matching pattern, or -1 if the
+// pattern is not a subsequence of text
+int fuzzy_score(const char *pattern, int pattern_len, const char *text, int text_len);
+
+// Writes the candidates that match into matches, best first, and
+// returns how many there are. matches needs room for count entries.
+int fuzzy_rank(const char *pattern, int pattern_len,
+               const FuzzyCandidate *candidates, int count, FuzzyMatch *matches);
+
+#endif
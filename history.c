@@ -1,39 +1,372 @@
+#define _GNU_SOURCE
 #include "history.h"
+#include "fuzzy.h"
+#include "history_store.h"
+#include "prompt.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void history_add(History *h, Line *line) {
-    if (h->count >= HISTORY_MAX) {
-        free(h->entries[0]);
-        memmove(h->entries, h->entries + 1, (HISTORY_MAX - 1) * sizeof(char *));
-        h->count--;
+static void free_entry(const char *entry) {
+    if (!history_store_owns(entry)) free((char *)entry);
+}
+
+const char *history_entry(const History *h, uint64_t seq) {
+    if (seq < h->first || seq >= h->next) return NULL;
+    return h->ring[seq % h->capacity];
+}
+
+// Slot holding text, or the empty slot where it would go
+static HistorySlot *find_slot(const History *h, const char *text, uint32_t hash) {
+    size_t mask = h->table_capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        HistorySlot *slot = &h->table[i];
+        if (slot->seq == 0) return slot;
+        if (slot->hash == hash && strcmp(h->ring[(slot->seq - 1) % h->capacity], text) == 0) {
+            return slot;
+        }
+    }
+}
+
+// Backward-shift deletion keeps probe sequences intact without tombstones
+static void remove_slot(History *h, HistorySlot *slot) {
+    size_t mask = h->table_capacity - 1;
+    size_t hole = slot - h->table;
+    for (size_t i = (hole + 1) & mask; h->table[i].seq != 0; i = (i + 1) & mask) {
+        size_t home = h->table[i].hash & mask;
+        bool movable = hole <= i ? (home <= hole || home > i) : (home <= hole && home > i);
+        if (movable) {
+            h->table[hole] = h->table[i];
+            hole = i;
+        }
     }
+    h->table[hole].seq = 0;
+}
 
-    // Check if the current line is different from the last entry
-    if (h->count == 0 || strcmp(line->buffer, h->entries[h->count - 1]) != 0) {
-        h->entries[h->count] = strdup(line->buffer);
-        if (!h->entries[h->count])
-            die("strdup");
-        h->count++;
+static void erase(History *h, uint64_t seq) {
+    const char *text = h->ring[seq % h->capacity];
+    if (!text) return;
+    remove_slot(h, find_slot(h, text, hash_bytes(text, strlen(text))));
+    free_entry(text);
+    h->ring[seq % h->capacity] = NULL;
+    h->live--;
+}
+
+static void build_index(History *h) {
+    if (h->indexed) return;
+    history_index_reset(&h->index, h->first);
+    for (uint64_t seq = h->first; seq < h->next; seq++) {
+        const char *text = h->ring[seq % h->capacity];
+        if (text) history_index_add(&h->index, seq, text);
+    }
+    h->indexed = true;
+}
+
+// Squeeze out erased slots; every entry gets a new seq
+static void compact(History *h) {
+    uint64_t seq = h->first;
+    for (uint64_t i = h->first; i < h->next; i++) {
+        const char *text = h->ring[i % h->capacity];
+        if (!text) continue;
+        HistorySlot *slot = find_slot(h, text, hash_bytes(text, strlen(text)));
+        h->ring[i % h->capacity] = NULL;
+        h->ring[seq % h->capacity] = text;
+        slot->seq = seq + 1;
+        seq++;
+    }
+    h->next = seq;
+    h->current = h->next;
+    if (h->indexed) {
+        history_index_free(&h->index);
+        h->indexed = false;
+    }
+}
+
+static void push(History *h, const char *text) {
+    uint32_t hash = hash_bytes(text, strlen(text));
+    HistorySlot *slot = find_slot(h, text, hash);
+    if (slot->seq != 0) {
+        erase(h, slot->seq - 1);
+        slot = find_slot(h, text, hash);
+    }
+
+    if (h->next - h->first == h->capacity) {
+        const char *oldest = h->ring[h->first % h->capacity];
+        if (h->indexed) history_index_trim(&h->index, h->first + 1, oldest ? oldest : "");
+        erase(h, h->first);
+        h->first++;
+        slot = find_slot(h, text, hash);
+    }
+
+    h->ring[h->next % h->capacity] = text;
+    slot->hash = hash;
+    slot->seq = h->next + 1;
+    if (h->indexed) history_index_add(&h->index, h->next, text);
+    h->next++;
+    h->live++;
+
+    // Erased slots still take room in the ring
+    if (h->live < (h->next - h->first) / 2) compact(h);
+}
+
+void history_init(History *h) {
+    const char *size = getenv("HISTSIZE");
+    h->capacity = size && atol(size) > 0 ? (size_t)atol(size) : HISTORY_DEFAULT_SIZE;
+    h->ring = calloc(h->capacity, sizeof(char *));
+    h->table_capacity = 16;
+    while (h->table_capacity < h->capacity * 2) h->table_capacity *= 2;
+    h->table = calloc(h->table_capacity, sizeof(HistorySlot));
+    if (!h->ring || !h->table) die("calloc");
+    h->index = (HistoryIndex){0};
+    h->indexed = false;
+
+    if (history_store_open()) {
+        size_t total = history_store_count();
+        size_t first = total > h->capacity ? total - h->capacity : 0;
+        for (size_t i = first; i < total; i++) {
+            const char *text = history_store_text(i, NULL);
+            if (text) push(h, text);
+        }
+        h->synced = total;
     }
+    h->current = h->next;
+}
 
-    h->current = h->count;
+// Push store records up to end that are not in the ring yet
+static void merge(History *h, size_t end) {
+    while (h->synced < end) {
+        const char *text = history_store_text(h->synced, NULL);
+        if (!text) break;
+        push(h, text);
+        h->synced++;
+    }
+}
+
+void history_sync(History *h) {
+    bool at_end = h->current == h->next;
+    merge(h, history_store_refresh());
+    if (at_end) h->current = h->next;
+}
+
+void history_add(History *h, Line *line, int exit_status, long duration_ms) {
+    const char *text = line_text(line);
+    history_sync(h);
+    const char *entry = history_store_append(text, line->length, exit_status, duration_ms);
+    if (entry) {
+        // Others may have got in between the sync and our append
+        size_t ours = history_store_count() - 1;
+        merge(h, ours);
+        h->synced = ours + 1;
+    } else {
+        entry = strdup(text);
+        if (!entry)
+            die("strdup");
+    }
+    push(h, entry);
+    h->current = h->next;
 }
 
 void handle_history(History *h, Line *line, int direction) {
-    int new_pos = h->current + direction;
-
-    if (new_pos < 0 || new_pos > h->count)
-        return;
-    if (new_pos == h->count) {
-        line->length = 0;
-        line->point = 0;
-        line->buffer[0] = '\0';
+    if (h->current == h->next) history_sync(h);
+    uint64_t seq = h->current;
+    do {
+        if (direction < 0 ? seq == h->first : seq == h->next) return;
+        seq += direction;
+    } while (seq != h->next && !h->ring[seq % h->capacity]);
+
+    if (seq == h->next) {
+        line_clear(line);
     } else {
-        strncpy(line->buffer, h->entries[new_pos], LINE_MAX - 1);
-        line->length = strlen(line->buffer);
-        line->point = line->length;
+        const char *text = h->ring[seq % h->capacity];
+        line_set(line, text, strlen(text));
     }
-    h->current = new_pos;
+    h->current = seq;
 }
 
+// Entries ranked against the line as it was when the search started.
+// Pressing again while the line still holds our pick moves to the next.
+static struct {
+    FuzzyMatch *matches;
+    uint64_t *seqs;  // Of each ranked candidate
+    int count;
+    int position;
+    unsigned version;  // Line version right after our last pick
+} fuzzy;
+
+void history_fuzzy_search(History *h, Line *line) {
+    bool continuing = fuzzy.count > 0 && line->version == fuzzy.version;
+
+    if (continuing) {
+        fuzzy.position = (fuzzy.position + 1) % fuzzy.count;
+    } else {
+        history_sync(h);
+        if (line->length == 0 || h->live == 0) return;
+
+        // Newest first, so ties go to the most recent command
+        FuzzyCandidate *candidates = malloc(h->live * sizeof(FuzzyCandidate));
+        fuzzy.matches = realloc(fuzzy.matches, h->live * sizeof(FuzzyMatch));
+        fuzzy.seqs = realloc(fuzzy.seqs, h->live * sizeof(uint64_t));
+        if (!candidates || !fuzzy.matches || !fuzzy.seqs) die("malloc");
+        int n = 0;
+        for (uint64_t seq = h->next; seq-- > h->first;) {
+            const char *entry = history_entry(h, seq);
+            if (!entry) continue;
+            fuzzy.seqs[n] = seq;
+            candidates[n++] = (FuzzyCandidate){ entry, strlen(entry) };
+        }
+        fuzzy.count = fuzzy_rank(line_text(line), line->length, candidates, n, fuzzy.matches);
+        fuzzy.position = 0;
+        free(candidates);
+        if (fuzzy.count == 0) return;
+    }
+
+    const char *entry = history_entry(h, fuzzy.seqs[fuzzy.matches[fuzzy.position].index]);
+    if (!entry) return;
+    line_set(line, entry, strlen(entry));
+    fuzzy.version = line->version;
+}
+
+// Entry containing query nearest to from, looking in direction. Only
+// the entries the index lists as candidates are visited.
+static bool find_match(const History *h, const char *query, size_t len,
+                       uint64_t from, int direction, uint64_t *found) {
+    if (from < h->first || from >= h->next) return false;
+
+    size_t count;
+    const uint32_t *seqs = history_index_candidates(&h->index, query, len, &count);
+
+    // First posting at or after from
+    uint32_t target = from - h->index.base;
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (seqs[mid] < target) low = mid + 1;
+        else high = mid;
+    }
+    if (direction < 0 && (low == count || seqs[low] != target)) {
+        if (low == 0) return false;
+        low--;
+    }
+
+    for (size_t i = low; i < count; i += direction) {
+        uint64_t seq = h->index.base + seqs[i];
+        if (seq < h->first || seq >= h->next) break;
+        const char *entry = h->ring[seq % h->capacity];
+        if (entry && memmem(entry, strlen(entry), query, len)) {
+            *found = seq;
+            return true;
+        }
+        if (i == 0 && direction < 0) break;
+    }
+    return false;
+}
+
+static struct {
+    bool active;
+    int direction;
+    char query[256];
+    size_t len;
+    bool matched;   // match holds an entry containing the query
+    bool failed;    // The last search found nothing new
+    uint64_t match;
+    char *original; // Line when the search started, for C-g
+    int original_point;
+    char prompt[sizeof("(failed reverse-i-search)`': ") + 256];
+} isearch;
+
+static void isearch_show(History *h, Line *line) {
+    snprintf(isearch.prompt, sizeof(isearch.prompt), "(%s%s-i-search)`%.*s': ",
+             isearch.failed ? "failed " : "",
+             isearch.direction < 0 ? "reverse" : "forward", (int)isearch.len, isearch.query);
+    prompt_override(isearch.prompt);
+    if (!isearch.matched) return;
+
+    const char *entry = history_entry(h, isearch.match);
+    if (!entry) return;
+    size_t length = strlen(entry);
+    line_set(line, entry, length);
+    const char *at = memmem(entry, length, isearch.query, isearch.len);
+    if (at) line->point = at - entry;
+    h->current = isearch.match;
+}
+
+// Look for the query starting at from; the old match stays on failure
+static void isearch_find(History *h, uint64_t from) {
+    build_index(h);
+    uint64_t found;
+    isearch.failed = !find_match(h, isearch.query, isearch.len, from, isearch.direction, &found);
+    if (!isearch.failed) {
+        isearch.match = found;
+        isearch.matched = true;
+    }
+}
+
+void history_isearch_start(History *h, Line *line, int direction) {
+    history_sync(h);
+    free(isearch.original);
+    isearch.original = strdup(line_text(line));
+    if (!isearch.original) die("strdup");
+    isearch.original_point = line->point;
+    isearch.active = true;
+    isearch.direction = direction;
+    isearch.len = 0;
+    isearch.matched = false;
+    isearch.failed = false;
+    isearch_show(h, line);
+}
+
+bool history_isearch_active(void) {
+    return isearch.active;
+}
+
+void history_isearch_insert(History *h, Line *line, char c) {
+    if (isearch.len == sizeof(isearch.query)) return;
+    isearch.query[isearch.len++] = c;
+    // The current match may still do; otherwise keep going the same way
+    uint64_t from = isearch.matched ? isearch.match
+                  : isearch.direction < 0 ? h->next - 1 : h->first;
+    isearch_find(h, from);
+    isearch_show(h, line);
+}
+
+void history_isearch_delete(History *h, Line *line) {
+    if (isearch.len == 0) return;
+    isearch.len--;
+    isearch.matched = false;
+    isearch.failed = false;
+    if (isearch.len > 0) {
+        isearch_find(h, isearch.direction < 0 ? h->next - 1 : h->first);
+    }
+    if (!isearch.matched) {
+        line_set(line, isearch.original, strlen(isearch.original));
+        line->point = isearch.original_point;
+        h->current = h->next;
+    }
+    isearch_show(h, line);
+}
+
+// Pressing C-r (C-s) again moves to the next older (newer) match
+void history_isearch_next(History *h, Line *line, int direction) {
+    isearch.direction = direction;
+    if (isearch.len > 0) {
+        uint64_t from = !isearch.matched ? (direction < 0 ? h->next - 1 : h->first)
+                                         : isearch.match + direction;
+        isearch_find(h, from);
+    }
+    isearch_show(h, line);
+}
+
+// Leave the line holding the match
+void history_isearch_accept(void) {
+    isearch.active = false;
+    prompt_override(NULL);
+}
+
+void history_isearch_cancel(History *h, Line *line) {
+    history_isearch_accept();
+    h->current = h->next;
+    line_set(line, isearch.original, strlen(isearch.original));
+    line->point = isearch.original_point;
+}
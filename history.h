@@ -1,18 +1,65 @@
 #ifndef HISTORY_H
 #define HISTORY_H
 
+#include "history_index.h"
 #include "line.h"
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
-#define HISTORY_MAX 1000
+#define HISTORY_DEFAULT_SIZE 1000
+
+// Entries live in a ring of $HISTSIZE slots, addressed by sequence
+// number: seq % capacity. Adding is O(1); the oldest slot is reused.
+// A hash from command text to seq finds an earlier copy of the same
+// command, which is erased (its slot left NULL) so the repeat only
+// appears as the newest entry. Rings with too many erased slots are
+// compacted, which keeps the amortized cost constant.
+//
+// Entries point into the mapped history file when it could be opened,
+// and are heap copies otherwise. Commands other shells save to the file
+// are pushed as history_sync() finds them, so every shell sees them in
+// the order they finished.
+//
+// The n-gram index over the ring is only built by the first C-r or
+// C-s, so shells that never search do not pay for it. From then on it
+// follows every push and eviction. Compaction renumbers entries, so it
+// drops the index for the next search to build again.
+
+typedef struct {
+    uint32_t hash;
+    uint64_t seq;  // seq + 1 of the entry; 0 marks an empty slot
+} HistorySlot;
 
 typedef struct {
-    char *entries[HISTORY_MAX];
-    int count;
-    size_t current;
+    const char **ring;
+    size_t capacity;
+    uint64_t first;     // Oldest seq still in the ring
+    uint64_t next;      // Seq the next entry gets
+    size_t live;        // Entries not erased
+    HistorySlot *table;
+    size_t table_capacity;
+    uint64_t current;   // Where C-p/C-n are; next means the line being typed
+    HistoryIndex index;
+    bool indexed;       // index covers the ring
+    size_t synced;      // Store records already pushed, ours or not
 } History;
 
-void history_add(History *h, Line *line);
+void history_init(History *h);
+void history_add(History *h, Line *line, int exit_status, long duration_ms);
+void history_sync(History *h);
+const char *history_entry(const History *h, uint64_t seq);
 void handle_history(History *h, Line *line, int direction);
+void history_fuzzy_search(History *h, Line *line);
+
+// Incremental search (C-r, C-s). While it is active the prompt shows
+// the query and the line holds the current match.
+void history_isearch_start(History *h, Line *line, int direction);
+bool history_isearch_active(void);
+void history_isearch_insert(History *h, Line *line, char c);
+void history_isearch_delete(History *h, Line *line);
+void history_isearch_next(History *h, Line *line, int direction);
+void history_isearch_accept(void);
+void history_isearch_cancel(History *h, Line *line);
 
 #endif
@@ -0,0 +1,133 @@
+#include "history_index.h"
+#include "line.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The length goes in the top byte, so grams of different lengths never
+// collide and none packs to 0
+static uint32_t gram_at(const char *text, size_t n) {
+    uint32_t gram = n << 24;
+    for (size_t i = 0; i < n; i++) gram |= (uint32_t)(unsigned char)text[i] << (8 * (n - 1 - i));
+    return gram;
+}
+
+// Fibonacci hashing; the high half of the product mixes in every bit
+static size_t gram_hash(uint32_t gram) {
+    return (gram * 0x9E3779B97F4A7C15ull) >> 32;
+}
+
+static Posting *find_posting(const HistoryIndex *index, uint32_t gram) {
+    size_t mask = index->table_capacity - 1;
+    for (size_t i = gram_hash(gram) & mask;; i = (i + 1) & mask) {
+        Posting *posting = &index->table[i];
+        if (posting->gram == gram || posting->gram == 0) return posting;
+    }
+}
+
+static void grow_table(HistoryIndex *index) {
+    Posting *old = index->table;
+    size_t old_capacity = index->table_capacity;
+    index->table_capacity = old_capacity ? old_capacity * 2 : 1024;
+    index->table = calloc(index->table_capacity, sizeof(Posting));
+    if (!index->table) die("calloc");
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].gram) *find_posting(index, old[i].gram) = old[i];
+    }
+    free(old);
+}
+
+void history_index_free(HistoryIndex *index) {
+    for (size_t i = 0; i < index->table_capacity; i++) free(index->table[i].seqs);
+    free(index->table);
+    index->table = NULL;
+    index->table_capacity = 0;
+    index->used = 0;
+}
+
+void history_index_reset(HistoryIndex *index, uint64_t base) {
+    history_index_free(index);
+    index->base = base;
+    index->first = 0;
+    grow_table(index);
+}
+
+// Drop the seqs that left the ring. They are at the front; the space is
+// given back once it is most of the list, which keeps trimming O(1)
+// amortized.
+static void trim_posting(const HistoryIndex *index, Posting *posting) {
+    while (posting->start < posting->count && posting->seqs[posting->start] < index->first) {
+        posting->start++;
+    }
+    if (posting->start == posting->count) {
+        free(posting->seqs);
+        posting->seqs = NULL;
+        posting->start = posting->count = posting->capacity = 0;
+    } else if (posting->start > posting->count / 2) {
+        posting->count -= posting->start;
+        memmove(posting->seqs, posting->seqs + posting->start, posting->count * sizeof(uint32_t));
+        posting->start = 0;
+    }
+}
+
+static void add_gram(HistoryIndex *index, uint32_t gram, uint32_t relative) {
+    Posting *posting = find_posting(index, gram);
+    if (posting->gram == 0) {
+        if ((index->used + 1) * 4 > index->table_capacity * 3) {
+            grow_table(index);
+            posting = find_posting(index, gram);
+        }
+        posting->gram = gram;
+        index->used++;
+    }
+    // A gram repeated within the entry is listed once
+    if (posting->count > 0 && posting->seqs[posting->count - 1] == relative) return;
+    trim_posting(index, posting);
+    if (posting->count == posting->capacity) {
+        posting->capacity = posting->capacity ? posting->capacity * 2 : 4;
+        posting->seqs = realloc(posting->seqs, posting->capacity * sizeof(uint32_t));
+        if (!posting->seqs) die("realloc");
+    }
+    posting->seqs[posting->count++] = relative;
+}
+
+void history_index_add(HistoryIndex *index, uint64_t seq, const char *text) {
+    uint32_t relative = seq - index->base;
+    size_t len = strlen(text);
+    for (size_t i = 0; i < len; i++) {
+        for (size_t n = 1; n <= 3 && i + n <= len; n++) {
+            add_gram(index, gram_at(text + i, n), relative);
+        }
+    }
+}
+
+void history_index_trim(HistoryIndex *index, uint64_t first, const char *text) {
+    index->first = first - index->base;
+    size_t len = strlen(text);
+    for (size_t i = 0; i < len; i++) {
+        for (size_t n = 1; n <= 3 && i + n <= len; n++) {
+            Posting *posting = find_posting(index, gram_at(text + i, n));
+            if (posting->gram != 0) trim_posting(index, posting);
+        }
+    }
+}
+
+const uint32_t *history_index_candidates(const HistoryIndex *index, const char *query,
+                                         size_t len, size_t *count) {
+    static const uint32_t none[1];
+    size_t n = len < 3 ? len : 3;
+    const Posting *shortest = NULL;
+    for (size_t i = 0; i + n <= len; i++) {
+        const Posting *posting = find_posting(index, gram_at(query + i, n));
+        if (posting->gram == 0) {
+            *count = 0;
+            return none;
+        }
+        if (!shortest || posting->count < shortest->count) shortest = posting;
+    }
+    if (!shortest) {
+        *count = 0;
+        return none;
+    }
+    *count = shortest->count - shortest->start;
+    return shortest->seqs + shortest->start;
+}
@@ -0,0 +1,45 @@
+#ifndef HISTORY_INDEX_H
+#define HISTORY_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// N-gram index over history entries, for incremental search.
+// Every one, two and three byte window of an entry maps to a posting
+// list of the entries that contain it, in seq order. A query only has
+// to look at the entries in the shortest list among its own trigrams
+// (or its one bigram or byte, while it is that short), which for
+// anything typed into C-r is a tiny fraction of the history. An erased
+// entry stays listed, and searches check each candidate anyway. Seqs
+// that fall out of the ring are trimmed off the front of a posting
+// whenever one of its grams is evicted or added again.
+
+typedef struct {
+    uint32_t gram;     // Length, then the bytes; 0 marks an empty slot
+    uint32_t start;    // Seqs before it were trimmed
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *seqs;    // Relative to the index base
+} Posting;
+
+typedef struct {
+    Posting *table;
+    size_t table_capacity;
+    size_t used;
+    uint64_t base;   // Seq postings are relative to
+    uint32_t first;  // Relative seqs before it are gone from the ring
+} HistoryIndex;
+
+void history_index_reset(HistoryIndex *index, uint64_t base);
+void history_index_free(HistoryIndex *index);
+void history_index_add(HistoryIndex *index, uint64_t seq, const char *text);
+
+// The ring now starts at first; text is the entry that just left it
+void history_index_trim(HistoryIndex *index, uint64_t first, const char *text);
+
+// Seqs (relative to index->base) of every entry that might contain
+// query, oldest first. *count is 0 when no entry can match.
+const uint32_t *history_index_candidates(const HistoryIndex *index, const char *query,
+                                         size_t len, size_t *count);
+
+#endif
@@ -0,0 +1,219 @@
+#include "history_store.h"
+#include "line.h"
+#include "util.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_MAGIC "SHHIST01"
+#define INDEX_MAGIC "SHHIDX01"
+#define LOG_RESERVE ((size_t)1 << 36)
+#define INDEX_RESERVE ((size_t)1 << 33)
+
+// A file mapped at the start of a fixed reservation
+typedef struct {
+    int fd;
+    char *base;
+    size_t size;
+    size_t reserved;
+} MappedFile;
+
+static struct {
+    bool open;
+    MappedFile log;
+    MappedFile index;
+} store = { .log.fd = -1, .index.fd = -1 };
+
+static char *data_dir(void) {
+    const char *base = getenv("XDG_DATA_HOME");
+    char path[PATH_MAX];
+
+    if (base && *base) {
+        snprintf(path, sizeof(path), "%s/shell/", base);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home) return NULL;
+        snprintf(path, sizeof(path), "%s/.local/share/shell/", home);
+    }
+    return strdup(path);
+}
+
+// Map whatever the file holds now over the start of its reservation
+static bool remap(MappedFile *file) {
+    struct stat st;
+    if (fstat(file->fd, &st) == -1 || (size_t)st.st_size > file->reserved) return false;
+    if ((size_t)st.st_size == file->size) return true;
+
+    if (st.st_size > 0 && mmap(file->base, st.st_size, PROT_READ,
+                               MAP_SHARED | MAP_FIXED, file->fd, 0) == MAP_FAILED) {
+        return false;
+    }
+    file->size = st.st_size;
+    return true;
+}
+
+static bool open_mapped(MappedFile *file, const char *path, size_t reserve, const char *magic) {
+    file->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (file->fd == -1) return false;
+
+    void *base = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) return false;
+    file->base = base;
+    file->reserved = reserve;
+    file->size = 0;
+
+    // A new file gets its magic; anything else must already have it
+    struct stat st;
+    if (fstat(file->fd, &st) == -1) return false;
+    if (st.st_size == 0 && !write_all(file->fd, magic, 8)) return false;
+    if (!remap(file) || file->size < 8 || memcmp(file->base, magic, 8) != 0) return false;
+    return true;
+}
+
+static void close_mapped(MappedFile *file) {
+    if (file->base) munmap(file->base, file->reserved);
+    if (file->fd != -1) close(file->fd);
+    file->base = NULL;
+    file->fd = -1;
+}
+
+static const uint64_t *offsets(void) {
+    return (const uint64_t *)(store.index.base + 8);
+}
+
+size_t history_store_count(void) {
+    return store.open ? (store.index.size - 8) / sizeof(uint64_t) : 0;
+}
+
+static const HistoryRecord *record_at(uint64_t offset) {
+    if (offset < 8 || offset + sizeof(HistoryRecord) > store.log.size) return NULL;
+    const HistoryRecord *record = (const void *)(store.log.base + offset);
+    if (offset + sizeof(HistoryRecord) + record->length >= store.log.size) return NULL;
+    return record;
+}
+
+// Index records the index does not cover yet, found by walking the log
+// from the end of the last indexed one. Only needed after a crash or
+// when the index was lost; the lock keeps other shells out meanwhile.
+static void catch_up(void) {
+    size_t count = history_store_count();
+    uint64_t offset = 8;
+    if (count > 0) {
+        const HistoryRecord *last = record_at(offsets()[count - 1]);
+        if (!last) return;
+        offset = offsets()[count - 1] + align8(sizeof(HistoryRecord) + last->length + 1);
+    }
+
+    uint64_t *missing = NULL;
+    size_t missing_count = 0, missing_capacity = 0;
+    const HistoryRecord *record;
+    while ((record = record_at(offset))) {
+        if (missing_count == missing_capacity) {
+            missing_capacity = missing_capacity ? missing_capacity * 2 : 64;
+            missing = realloc(missing, missing_capacity * sizeof(uint64_t));
+            if (!missing) die("realloc");
+        }
+        missing[missing_count++] = offset;
+        offset += align8(sizeof(HistoryRecord) + record->length + 1);
+    }
+
+    if (missing_count > 0 && write_all(store.index.fd, missing, missing_count * sizeof(uint64_t))) {
+        remap(&store.index);
+    }
+    free(missing);
+}
+
+bool history_store_open(void) {
+    char *dir = data_dir();
+    if (!dir) return false;
+    mkdir_parents(dir);
+
+    char log_path[PATH_MAX], index_path[PATH_MAX];
+    snprintf(log_path, sizeof(log_path), "%shistory", dir);
+    snprintf(index_path, sizeof(index_path), "%shistory.idx", dir);
+    free(dir);
+
+    if (!open_mapped(&store.log, log_path, LOG_RESERVE, LOG_MAGIC)
+        || !open_mapped(&store.index, index_path, INDEX_RESERVE, INDEX_MAGIC)) {
+        close_mapped(&store.log);
+        close_mapped(&store.index);
+        return false;
+    }
+
+    store.open = true;
+    flock(store.index.fd, LOCK_EX);
+    remap(&store.log);
+    remap(&store.index);
+    catch_up();
+    flock(store.index.fd, LOCK_UN);
+    return true;
+}
+
+// Other shells append to the same files; one fstat tells whether they
+// have since the last look. The log is remapped first: it is written
+// before the index, so every indexed record is then mapped too.
+size_t history_store_refresh(void) {
+    if (!store.open) return 0;
+    struct stat st;
+    if (fstat(store.index.fd, &st) == 0 && (size_t)st.st_size != store.index.size) {
+        remap(&store.log);
+        remap(&store.index);
+    }
+    return history_store_count();
+}
+
+bool history_store_owns(const char *text) {
+    return store.open && text >= store.log.base && text < store.log.base + store.log.reserved;
+}
+
+const char *history_store_text(size_t i, const HistoryRecord **record) {
+    if (i >= history_store_count()) return NULL;
+    const HistoryRecord *r = record_at(offsets()[i]);
+    if (!r) return NULL;
+    if (record) *record = r;
+    return (const char *)(r + 1);
+}
+
+// One write() per record, with O_APPEND, so records from concurrent
+// shells never interleave. The index lock only keeps the index in log
+// order. The index is remapped while the lock is held, so the new
+// record is the last one history_store_count() covers afterwards.
+const char *history_store_append(const char *text, size_t len, int exit_status,
+                                 uint32_t duration_ms) {
+    if (!store.open) return NULL;
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) cwd[0] = '\0';
+
+    size_t size = align8(sizeof(HistoryRecord) + len + 1);
+    char *buf = calloc(1, size);
+    if (!buf) return NULL;
+    HistoryRecord *record = (HistoryRecord *)buf;
+    record->timestamp = time(NULL);
+    record->cwd_hash = hash_bytes(cwd, strlen(cwd));
+    record->exit_status = exit_status;
+    record->duration_ms = duration_ms;
+    record->length = len;
+    memcpy(buf + sizeof(HistoryRecord), text, len);
+
+    const char *result = NULL;
+    flock(store.index.fd, LOCK_EX);
+    off_t offset = lseek(store.log.fd, 0, SEEK_END);
+    if (offset != -1 && write_all(store.log.fd, buf, size)) {
+        uint64_t entry = offset;
+        if (write_all(store.index.fd, &entry, sizeof(entry))
+            && remap(&store.log) && remap(&store.index)) {
+            result = history_store_text(history_store_count() - 1, NULL);
+        }
+    }
+    flock(store.index.fd, LOCK_UN);
+    free(buf);
+    return result;
+}
@@ -0,0 +1,36 @@
+#ifndef HISTORY_STORE_H
+#define HISTORY_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Persistent history.
+// $XDG_DATA_HOME/shell/history is an append-only log: each record is a
+// fixed header followed by the command and a NUL, padded to 8 bytes.
+// history.idx next to it holds the offset of every record in log
+// order, so loading is two mmaps and no parsing. Both files are mapped
+// into address space reserved up front; when they grow the mapping is
+// extended in place, so pointers into it stay valid for the life of
+// the shell and entries need no copies.
+//
+// Any number of shells can share the files. history_store_refresh()
+// picks up what the others appended, without rereading anything.
+
+typedef struct {
+    int64_t timestamp;     // Seconds since the epoch, when it finished
+    uint32_t cwd_hash;     // FNV-1a of the directory it ran in
+    int32_t exit_status;
+    uint32_t duration_ms;
+    uint32_t length;       // Of the command, without the NUL
+} HistoryRecord;
+
+bool history_store_open(void);
+size_t history_store_count(void);
+const char *history_store_text(size_t i, const HistoryRecord **record);
+bool history_store_owns(const char *text);
+size_t history_store_refresh(void);
+const char *history_store_append(const char *text, size_t len, int exit_status,
+                                 uint32_t duration_ms);
+
+#endif
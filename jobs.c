@@ -0,0 +1,426 @@
+#define _GNU_SOURCE
+#include "jobs.h"
+#include "frame.h"
+#include "line.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Terminal signals the shell ignores and its children must not
+static const int job_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU };
+#define JOB_SIGNAL_COUNT (int)(sizeof(job_signals) / sizeof(*job_signals))
+
+static bool job_control = false;
+static pid_t shell_pgid;
+static struct termios shell_modes;
+static int child_pipe[2] = { -1, -1 };
+
+// Background and stopped jobs, in the order they got their ids
+static struct {
+    Job **items;
+    int count;
+    int capacity;
+    unsigned long clock;
+} table;
+
+static void on_sigchld(int sig) {
+    (void)sig;
+    int saved = errno;
+    char byte = 0;
+    // A full pipe already has a wakeup pending
+    write(child_pipe[1], &byte, 1);
+    errno = saved;
+}
+
+void jobs_init(void) {
+    if (!isatty(STDIN_FILENO)) return;
+
+    // Started in the background: wait until we are let into the foreground
+    while (tcgetpgrp(STDIN_FILENO) != getpgrp()) kill(-getpgrp(), SIGTTIN);
+
+    for (int i = 0; i < JOB_SIGNAL_COUNT; i++) signal(job_signals[i], SIG_IGN);
+
+    // A session leader already leads its group
+    if (getpgrp() != getpid()) setpgid(0, 0);
+    shell_pgid = getpgrp();
+    if (tcsetpgrp(STDIN_FILENO, shell_pgid) == -1) return;
+    tcgetattr(STDIN_FILENO, &shell_modes);
+
+    if (pipe2(child_pipe, O_CLOEXEC | O_NONBLOCK) == -1) die("pipe2");
+    struct sigaction sa = {0};
+    sa.sa_handler = on_sigchld;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGCHLD, &sa, NULL) == -1) die("sigaction");
+    job_control = true;
+}
+
+int jobs_watch_fd(void) {
+    return child_pipe[0];
+}
+
+static void job_free(Job *job) {
+    free(job->command);
+    free(job->processes);
+    free(job);
+}
+
+static void process_update(JobProcess *p, int wstatus) {
+    if (WIFSTOPPED(wstatus)) {
+        p->stopped = true;
+        p->signal = WSTOPSIG(wstatus);
+        p->status = 128 + p->signal;
+    } else if (WIFCONTINUED(wstatus)) {
+        p->stopped = false;
+    } else {
+        p->done = true;
+        p->stopped = false;
+        p->signal = WIFSIGNALED(wstatus) ? WTERMSIG(wstatus) : 0;
+        p->status = p->signal ? 128 + p->signal : WEXITSTATUS(wstatus);
+    }
+}
+
+// Running while any process is, stopped while the rest are stopped
+static JobState job_state(const Job *job) {
+    bool stopped = false;
+    for (int i = 0; i < job->count; i++) {
+        const JobProcess *p = &job->processes[i];
+        if (p->done) continue;
+        if (!p->stopped) return JOB_RUNNING;
+        stopped = true;
+    }
+    return stopped ? JOB_STOPPED : JOB_DONE;
+}
+
+// The last stage's, or the stop signal's for a stopped job
+static int job_status(const Job *job) {
+    for (int i = job->count - 1; i >= 0; i--) {
+        if (job->processes[i].stopped) return job->processes[i].status;
+    }
+    return job->count ? job->processes[job->count - 1].status : 0;
+}
+
+static void table_insert(Job *job) {
+    job->touched = ++table.clock;
+    job->state = job_state(job);
+    if (job->id) return;
+
+    if (table.count == table.capacity) {
+        table.capacity = table.capacity ? table.capacity * 2 : 8;
+        table.items = realloc(table.items, table.capacity * sizeof(Job *));
+        if (!table.items) die("realloc");
+    }
+    int id = 0;
+    for (int i = 0; i < table.count; i++) {
+        if (table.items[i]->id > id) id = table.items[i]->id;
+    }
+    job->id = id + 1;
+    table.items[table.count++] = job;
+}
+
+static void table_remove(Job *job) {
+    for (int i = 0; i < table.count; i++) {
+        if (table.items[i] != job) continue;
+        memmove(&table.items[i], &table.items[i + 1], (table.count - i - 1) * sizeof(Job *));
+        table.count--;
+        return;
+    }
+}
+
+// %+ is the job touched last, %- the one before
+static Job *table_recent(int rank) {
+    Job *first = NULL, *second = NULL;
+    for (int i = 0; i < table.count; i++) {
+        Job *job = table.items[i];
+        if (!first || job->touched > first->touched) {
+            second = first;
+            first = job;
+        } else if (!second || job->touched > second->touched) {
+            second = job;
+        }
+    }
+    return rank == 0 ? first : second;
+}
+
+static char job_marker(const Job *job) {
+    return job == table_recent(0) ? '+' : job == table_recent(1) ? '-' : ' ';
+}
+
+static void describe(const Job *job, char *out, size_t size) {
+    char state[64];
+    int sig = 0;
+    for (int i = 0; i < job->count; i++) {
+        if (job->processes[i].stopped) sig = job->processes[i].signal;
+    }
+    const JobProcess *last = job->count ? &job->processes[job->count - 1] : NULL;
+
+    if (job->state == JOB_RUNNING) {
+        snprintf(state, sizeof(state), "Running");
+    } else if (job->state == JOB_STOPPED) {
+        snprintf(state, sizeof(state), "%s", sig == SIGTTIN ? "Stopped (tty input)"
+                                           : sig == SIGTTOU ? "Stopped (tty output)"
+                                           : "Stopped");
+    } else if (last && last->signal) {
+        snprintf(state, sizeof(state), "%s", strsignal(last->signal));
+    } else if (last && last->status) {
+        snprintf(state, sizeof(state), "Exit %d", last->status);
+    } else {
+        snprintf(state, sizeof(state), "Done");
+    }
+    snprintf(out, size, "[%d]%c  %-24s%s", job->id, job_marker(job), state, job->command);
+}
+
+bool jobs_reap(void) {
+    char drain[64];
+    while (child_pipe[0] != -1 && read(child_pipe[0], drain, sizeof(drain)) > 0) {}
+
+    bool changed = false;
+    for (int i = 0; i < table.count; i++) {
+        Job *job = table.items[i];
+        for (int j = 0; j < job->count; j++) {
+            JobProcess *p = &job->processes[j];
+            int wstatus;
+            if (p->done) continue;
+            if (waitpid(p->pid, &wstatus, WNOHANG | WUNTRACED | WCONTINUED) > 0) {
+                process_update(p, wstatus);
+            }
+        }
+        JobState state = job_state(job);
+        if (state != job->state) {
+            job->state = state;
+            if (state != JOB_RUNNING) {
+                job->notify = true;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+bool jobs_notify(void) {
+    bool printed = false;
+    for (int i = 0; i < table.count;) {
+        Job *job = table.items[i];
+        if (job->notify) {
+            char text[1024];
+            describe(job, text, sizeof(text));
+            frame_printf("%s\r\n", text);
+            job->notify = false;
+            printed = true;
+        }
+        if (job->state == JOB_DONE) {
+            table_remove(job);
+            job_free(job);
+            continue;
+        }
+        i++;
+    }
+    return printed;
+}
+
+Job *job_new(const char *command, int length, bool foreground) {
+    Job *job = calloc(1, sizeof(Job));
+    if (!job) die("calloc");
+    job->command = strndup(command, length);
+    if (!job->command) die("strndup");
+    job->foreground = foreground;
+    return job;
+}
+
+void job_spawnattr(const Job *job, posix_spawnattr_t *attr) {
+    if (!job_control) return;
+    short flags;
+    posix_spawnattr_getflags(attr, &flags);
+    posix_spawnattr_setpgroup(attr, job->pgid);
+
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    for (int i = 0; i < JOB_SIGNAL_COUNT; i++) sigaddset(&defaults, job_signals[i]);
+    posix_spawnattr_setsigdefault(attr, &defaults);
+    posix_spawnattr_setflags(attr, flags | POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
+}
+
+void job_child(const Job *job) {
+    if (!job_control) return;
+    setpgid(0, job->pgid);
+    // Still ignoring SIGTTOU, so this works from the background group
+    if (job->foreground) tcsetpgrp(STDIN_FILENO, getpgrp());
+    for (int i = 0; i < JOB_SIGNAL_COUNT; i++) signal(job_signals[i], SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    job_control = false;
+}
+
+void job_add(Job *job, pid_t pid, int status) {
+    if (job->count == job->capacity) {
+        job->capacity = job->capacity ? job->capacity * 2 : 4;
+        job->processes = realloc(job->processes, job->capacity * sizeof(JobProcess));
+        if (!job->processes) die("realloc");
+    }
+    job->processes[job->count++] = (JobProcess){ .pid = pid, .status = status, .done = pid == -1 };
+    if (pid == -1 || !job_control) return;
+
+    // Both sides set the group, so it is in place whichever runs first
+    if (!job->pgid) job->pgid = pid;
+    setpgid(pid, job->pgid);
+    if (job->foreground && pid == job->pgid) tcsetpgrp(STDIN_FILENO, job->pgid);
+}
+
+int job_wait(Job *job) {
+    while (job_state(job) == JOB_RUNNING) {
+        JobProcess *p = job->processes;
+        while (p->done || p->stopped) p++;
+
+        int wstatus;
+        if (waitpid(p->pid, &wstatus, job_control ? WUNTRACED : 0) == -1) {
+            if (errno == EINTR) continue;
+            p->done = true;
+            p->status = 1;
+            continue;
+        }
+        // A spawned process can touch the terminal before the shell
+        // has handed it over; it has it now
+        if (job_control && WIFSTOPPED(wstatus)
+            && (WSTOPSIG(wstatus) == SIGTTIN || WSTOPSIG(wstatus) == SIGTTOU)) {
+            kill(-job->pgid, SIGCONT);
+            continue;
+        }
+        process_update(p, wstatus);
+    }
+
+    JobState state = job_state(job);
+    int result = job_status(job);
+    if (!job_control) {
+        job_free(job);
+        return result;
+    }
+
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    const JobProcess *last = job->count ? &job->processes[job->count - 1] : NULL;
+    int sig = last && last->done ? last->signal : 0;
+    if (state == JOB_STOPPED) {
+        job->has_modes = tcgetattr(STDIN_FILENO, &job->modes) == 0;
+    }
+    // Whatever a stopped or killed job left the terminal in is not ours
+    if (state == JOB_STOPPED || sig) tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_modes);
+
+    if (state == JOB_STOPPED) {
+        job->foreground = false;
+        table_insert(job);
+        char text[1024];
+        describe(job, text, sizeof(text));
+        printf("\n%s\n", text);
+        fflush(stdout);
+        return result;
+    }
+
+    if (sig == SIGINT) {
+        printf("\n");
+    } else if (sig && sig != SIGPIPE) {
+        printf("%s\n", strsignal(sig));
+    }
+    fflush(stdout);
+    if (job->id) table_remove(job);
+    job_free(job);
+    return result;
+}
+
+void job_background(Job *job) {
+    if (!job_control) {
+        job_free(job);
+        return;
+    }
+    job->foreground = false;
+    table_insert(job);
+    job->state = JOB_RUNNING;  // So jobs_reap() reports it even if it is already done
+    fprintf(stderr, "[%d] %d\n", job->id, (int)job->pgid);
+}
+
+// %n, n, %+, %% and %-; no argument means the current job
+static Job *find_job(const char *builtin, const char *spec) {
+    Job *job = NULL;
+    if (!spec || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+        job = table_recent(0);
+    } else if (strcmp(spec, "%-") == 0) {
+        job = table_recent(1);
+    } else {
+        const char *digits = spec[0] == '%' ? spec + 1 : spec;
+        char *end;
+        long id = strtol(digits, &end, 10);
+        for (int i = 0; *digits && !*end && i < table.count; i++) {
+            if (table.items[i]->id == id) job = table.items[i];
+        }
+    }
+    if (!job) {
+        if (spec) fprintf(stderr, "%s: %s: no such job\n", builtin, spec);
+        else fprintf(stderr, "%s: no current job\n", builtin);
+    }
+    return job;
+}
+
+static void job_continue(Job *job) {
+    for (int i = 0; i < job->count; i++) job->processes[i].stopped = false;
+    job->state = JOB_RUNNING;
+    job->notify = false;
+    job->touched = ++table.clock;
+    if (job->pgid) kill(-job->pgid, SIGCONT);
+}
+
+int jobs_builtin(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    jobs_reap();
+    for (int i = 0; i < table.count;) {
+        Job *job = table.items[i];
+        char text[1024];
+        describe(job, text, sizeof(text));
+        printf("%s\n", text);
+        job->notify = false;
+        if (job->state == JOB_DONE) {
+            table_remove(job);
+            job_free(job);
+            continue;
+        }
+        i++;
+    }
+    return 0;
+}
+
+int fg_builtin(int argc, char **argv) {
+    if (!job_control) {
+        fprintf(stderr, "fg: no job control\n");
+        return 1;
+    }
+    Job *job = find_job("fg", argc > 1 ? argv[1] : NULL);
+    if (!job) return 1;
+
+    printf("%s\n", job->command);
+    fflush(stdout);
+    job->foreground = true;
+    if (job->has_modes) tcsetattr(STDIN_FILENO, TCSADRAIN, &job->modes);
+    if (job->pgid) tcsetpgrp(STDIN_FILENO, job->pgid);
+    job_continue(job);
+    return job_wait(job);
+}
+
+int bg_builtin(int argc, char **argv) {
+    if (!job_control) {
+        fprintf(stderr, "bg: no job control\n");
+        return 1;
+    }
+    Job *job = find_job("bg", argc > 1 ? argv[1] : NULL);
+    if (!job) return 1;
+    if (job->state == JOB_RUNNING) {
+        fprintf(stderr, "bg: job %d already in background\n", job->id);
+        return 0;
+    }
+
+    job->foreground = false;
+    job_continue(job);
+    printf("[%d]%c %s &\n", job->id, job_marker(job), job->command);
+    return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <spawn.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <termios.h>
+
+// Job control.
+// Every pipeline the shell starts is a job with a process group of its
+// own. A foreground job is handed the terminal with tcsetpgrp(), so C-c
+// and C-z reach it and not the shell, and the shell waits until it
+// finishes or stops; a background one (`cmd &`) keeps running while the
+// prompt is back. SIGCHLD only writes a byte to a pipe the input loop
+// polls, and jobs_reap() collects the status changes from there.
+//
+// Forked children (subshells, piped builtins) run their own commands
+// without job control, in the job's process group.
+
+typedef struct {
+    pid_t pid;     // -1 for a stage that failed to start
+    int status;    // Exit status, or 128 + the signal
+    int signal;    // That terminated or stopped it, or 0
+    bool done;
+    bool stopped;
+} JobProcess;
+
+typedef enum {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE,
+} JobState;
+
+typedef struct {
+    int id;                // [id], 0 until the job is in the table
+    pid_t pgid;            // The first process's pid
+    char *command;
+    bool foreground;
+    JobProcess *processes;
+    int count;
+    int capacity;
+    JobState state;
+    bool notify;           // Stopped or done since the user was told
+    unsigned long touched; // Most recent is the current job, %+
+    bool has_modes;        // Terminal modes it stopped with
+    struct termios modes;
+} Job;
+
+// Takes the terminal and sets up SIGCHLD; job control stays off when
+// stdin is not a terminal
+void jobs_init(void);
+int jobs_watch_fd(void);
+
+// Collects status changes of background jobs; true if one finished or
+// stopped and jobs_notify() has something to say
+bool jobs_reap(void);
+// Prints "[1]+  Done  cmd" lines for those, and forgets finished jobs.
+// Returns true if anything was printed.
+bool jobs_notify(void);
+
+Job *job_new(const char *command, int length, bool foreground);
+
+// Spawn attributes for a stage of job: its process group, and default
+// dispositions for the signals the shell ignores
+void job_spawnattr(const Job *job, posix_spawnattr_t *attr);
+// The same, from inside a forked child
+void job_child(const Job *job);
+
+// Records a started stage (pid -1 with status for one that failed)
+void job_add(Job *job, pid_t pid, int status);
+
+// Waits until the job finishes or stops, with the terminal handed over
+// meanwhile. A stopped job goes into the table; a finished one is
+// freed. Returns the last stage's status.
+int job_wait(Job *job);
+// Leaves the job running and puts it in the table
+void job_background(Job *job);
+
+int jobs_builtin(int argc, char **argv);
+int fg_builtin(int argc, char **argv);
+int bg_builtin(int argc, char **argv);
+
+#endif
@@ -1,124 +1,225 @@
 #include "line.h"
 #include "prompt.h"
+#include "render.h"
+#include "frame.h"
 #include "ansi_codes.h"
 #include "electric_pair_mode.h"
+#include "builtin.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <dirent.h>
-
-// TODO Make a struct
-static char** cached_commands = NULL;
-static size_t cached_commands_count = 0;
-static size_t cached_commands_capacity = 0;
-
-// Initialize command cache on startup
-void init_command_cache(void) {
-    cached_commands_capacity = 1024;  // Initial capacity
-    cached_commands = malloc(cached_commands_capacity * sizeof(char*));
-    cached_commands_count = 0;
-    
-    char* path = getenv("PATH");
-    if (!path) return;
-    
-    char* path_copy = strdup(path);
-    char* dir_str = strtok(path_copy, ":");
-    
-    while (dir_str) {
-        DIR* dir = opendir(dir_str);
-        if (dir) {
-            struct dirent* entry;
-            while ((entry = readdir(dir)) != NULL) {
-                char full_path[LINE_MAX];
-                snprintf(full_path, sizeof(full_path), "%s/%s", dir_str, entry->d_name);
-                
-                // Check if file is executable
-                if (access(full_path, X_OK) == 0) {
-                    // Resize if needed
-                    if (cached_commands_count >= cached_commands_capacity) {
-                        cached_commands_capacity *= 2;
-                        cached_commands = realloc(cached_commands, 
-                                                  cached_commands_capacity * sizeof(char*));
-                    }
-                    cached_commands[cached_commands_count++] = strdup(entry->d_name);
-                }
-            }
-            closedir(dir);
-        }
-        dir_str = strtok(NULL, ":");
+
+static const char *command_state_color(CommandState state) {
+    switch (state) {
+    case COMMAND_VALID:   return GREEN;
+    case COMMAND_PARTIAL: return YELLOW;
+    default:              return RED;
     }
-    
-    free(path_copy);
 }
 
-void free_command_cache(void) {
-    for (size_t i = 0; i < cached_commands_count; i++) {
-        free(cached_commands[i]);
+static void line_move_gap(Line *line, int pos) {
+    delim_move_gap(&line->delims, line->gap_start, pos, line->length);
+    if (pos < line->gap_start) {
+        int n = line->gap_start - pos;
+        memmove(line->text + line->gap_end - n, line->text + pos, n);
+        line->gap_start -= n;
+        line->gap_end -= n;
+    } else if (pos > line->gap_start) {
+        int n = pos - line->gap_start;
+        memmove(line->text + line->gap_start, line->text + line->gap_end, n);
+        line->gap_start += n;
+        line->gap_end += n;
     }
-    free(cached_commands);
-    cached_commands = NULL;
-    cached_commands_count = 0;
-}
-
-
-// TODO Why cd is not found but c does ? 
-bool is_valid_partial_command(const char* partial) {
-    if (!partial || !*partial) return false;
-    
-    size_t partial_len = strlen(partial);
-    for (size_t i = 0; i < cached_commands_count; i++) {
-        // Only return true if we find an EXACT match
-        if (strlen(cached_commands[i]) == partial_len && 
-            strcmp(cached_commands[i], partial) == 0) {
-            return true;
-        }
+}
+
+// Make room for `extra` more bytes, plus one for line_text()'s NUL
+static void line_reserve(Line *line, int extra) {
+    if (line->gap_end - line->gap_start > extra) return;
+
+    int capacity = line->capacity ? line->capacity : 256;
+    while (capacity - line->length <= extra) capacity *= 2;
+
+    char *text = malloc(capacity);
+    if (!text) die("malloc");
+    int after = line->capacity - line->gap_end;
+    if (line->text) {
+        memcpy(text, line->text, line->gap_start);
+        memcpy(text + capacity - after, line->text + line->gap_end, after);
     }
-    return false;
+    free(line->text);
+
+    line->text = text;
+    line->gap_end = capacity - after;
+    line->capacity = capacity;
 }
 
+static void shift_position(int *pos, int start, int end) {
+    if (*pos >= end) *pos -= end - start;
+    else if (*pos > start) *pos = start;
+}
 
-void clear_line(Line *line) {
-    printf("\r");
-    draw_prompt(status);
-    
-    if (line->length > 0) {
-        // Find first word (command)
-        char* space = strchr(line->buffer, ' ');
-        int cmd_len = space ? (space - line->buffer) : line->length;
-        
-        // Only check command if it changed
-        if (!line->current_command || 
-            strncmp(line->current_command, line->buffer, cmd_len) != 0 || 
-            (line->current_command[cmd_len] != '\0')) {
-            
-            // Update current command
-            free(line->current_command);
-            line->current_command = strndup(line->buffer, cmd_len);
-            line->is_valid_command = is_valid_partial_command(line->current_command);
-        }
-        
-        // Print command portion with color
-        printf("%s%.*s%s", 
-               line->is_valid_command ? GREEN : RED,
-               cmd_len, 
-               line->buffer,
-               COLOR_RESET);
-        
-        // Print rest of line if any
-        if (cmd_len < line->length) {
-            printf("%s", line->buffer + cmd_len);
+// Insert at point and move point past the new text
+void line_insert(Line *line, const char *text, int len) {
+    if (len <= 0) return;
+    line_reserve(line, len);
+    line_move_gap(line, line->point);
+    memcpy(line->text + line->gap_start, text, len);
+    for (int i = 0; i < len; i++) {
+        delim_insert(&line->delims, line->gap_start + i, text[i]);
+    }
+    line->gap_start += len;
+    line->length += len;
+    line->version++;
+    if (line->mark > line->point) line->mark += len;
+    line->point += len;
+}
+
+void line_delete(Line *line, int start, int end) {
+    if (start < 0) start = 0;
+    if (end > line->length) end = line->length;
+    if (start >= end) return;
+
+    line_move_gap(line, end);
+    delim_truncate(&line->delims, start);
+    line->gap_start = start;
+    line->length -= end - start;
+    line->version++;
+    shift_position(&line->point, start, end);
+    shift_position(&line->mark, start, end);
+}
+
+void line_set(Line *line, const char *text, int len) {
+    line->gap_start = 0;
+    line->gap_end = line->capacity;
+    line->length = 0;
+    line->point = 0;
+    line->mark = 0;
+    line->version++;
+    delim_reset(&line->delims);
+    line_insert(line, text, len);
+}
+
+void line_clear(Line *line) {
+    line_set(line, "", 0);
+}
+
+char line_char_at(const Line *line, int i) {
+    return i < line->gap_start ? line->text[i] : line->text[i + line->gap_end - line->gap_start];
+}
+
+void line_copy(const Line *line, int start, int end, char *out) {
+    const char *before, *after;
+    int before_len, after_len;
+    line_segments(line, &before, &before_len, &after, &after_len);
+
+    if (start < before_len) {
+        int n = (end < before_len ? end : before_len) - start;
+        memcpy(out, before + start, n);
+        out += n;
+        start += n;
+    }
+    if (start < end) memcpy(out, after + start - before_len, end - start);
+}
+
+void line_segments(const Line *line, const char **before, int *before_len,
+                   const char **after, int *after_len) {
+    *before = line->text;
+    *before_len = line->gap_start;
+    *after = line->text ? line->text + line->gap_end : NULL;
+    *after_len = line->length - line->gap_start;
+}
+
+// Close the gap at the end and return the contents as a C string.
+// Costs a memmove of everything after the gap, so it is meant for
+// running, completing and saving the line, not for every keystroke.
+const char *line_text(Line *line) {
+    line_reserve(line, 0);
+    line_move_gap(line, line->length);
+    line->text[line->length] = '\0';
+    return line->text;
+}
+
+// The delimiter index answers questions about point only with the gap there
+const DelimIndex *line_delimiters(Line *line) {
+    line_move_gap(line, line->point);
+    return &line->delims;
+}
+
+void forward_list(Line *line) {
+    int pos = forward_list_position(line_delimiters(line), line->length);
+    if (pos >= 0) line->point = pos;
+}
+
+void backward_list(Line *line) {
+    int pos = backward_list_position(line_delimiters(line), line->point);
+    if (pos >= 0) line->point = pos;
+}
+
+static const char *token_color(const Ast *ast, const AstToken *token) {
+    switch (token->kind) {
+    case TOKEN_COMMAND: {
+        int len = token->end - token->start;
+        char name[64];
+        if (len < (int)sizeof(name)) {
+            memcpy(name, ast->text + token->start, len);
+            name[len] = '\0';
+            if (is_builtin(name)) return GREEN;
         }
+        return command_state_color(command_cache_classify(ast->text + token->start, len));
     }
-    
-    // Move cursor to correct position
-    if (line->point < line->length) {
-        for (int i = 0; i < (line->length - line->point); i++) {
-            printf(CURSOR_LEFT);
+    case TOKEN_KEYWORD:    return BOLD;
+    case TOKEN_OPERATOR:
+    case TOKEN_REDIRECT:   return CYAN;
+    case TOKEN_STRING:     return YELLOW;
+    case TOKEN_VARIABLE:   return MAGENTA;
+    case TOKEN_COMMENT:    return DIM;
+    default:               return NULL;
+    }
+}
+
+// Colors come from the parse, words first and then the strings and
+// expansions inside them on top
+static void highlight(Line *line) {
+    const Ast *ast = line->ast;
+    line->spans = realloc(line->spans, (ast->token_count + 1) * sizeof(RenderSpan));
+    if (!line->spans) die("realloc");
+    line->span_count = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < ast->token_count; i++) {
+            const AstToken *token = &ast->tokens[i];
+            if (token_is_part(token->kind) != (pass == 1)) continue;
+            const char *color = token_color(ast, token);
+            if (color) {
+                line->spans[line->span_count++] = (RenderSpan){ token->start, token->end, color };
+            }
         }
     }
-    
-    fflush(stdout);
+}
+
+// Parsed once per edit; highlighting and running the line share it
+const Ast *line_ast(Line *line) {
+    if (line->ast && line->ast_version == line->version) return line->ast;
+    ast_free(line->ast);
+    line->ast = ast_parse(line_text(line), line->length);
+    line->ast_version = line->version;
+    highlight(line);
+    return line->ast;
+}
+
+// Commands appeared or went away, so the colors may be wrong
+void line_refresh_highlighting(Line *line) {
+    if (line->ast) highlight(line);
+}
+
+// Redraw the line; only what changed since the last call reaches the terminal
+void clear_line(Line *line) {
+    line_ast(line);
+    const char *before, *after;
+    int before_len, after_len;
+    line_segments(line, &before, &before_len, &after, &after_len);
+    render_line(prompt_string(status), before, before_len, after, after_len, line->point,
+                line->spans, line->span_count);
 }
 
 /* void clear_line(Line *line) { */
@@ -131,9 +232,9 @@ void clear_line(Line *line) {
 /* } */
 
 void clear_screen(Line *line) {
-    printf(CLEAR_SCREEN);
+    frame_puts(CLEAR_SCREEN);
+    render_invalidate();
     clear_line(line);
-    fflush(stdout);
 }
 
 // TODO Render region
@@ -142,9 +243,7 @@ void set_mark(Line *line) {
 }
 
 void kill_line(Line *line) {
-    line->length = line->point;
-    line->buffer[line->length] = '\0';
-    clear_line(line);
+    line_delete(line, line->point, line->length);
 }
 
 void kill_region(Line *line) {
@@ -153,23 +252,14 @@ void kill_region(Line *line) {
     int start = (line->point < line->mark) ? line->point : line->mark;
     int end = (line->point > line->mark) ? line->point : line->mark;
 
-    memmove(line->buffer + start, line->buffer + end, line->length - end);
-    line->length -= (end - start);
-    line->buffer[line->length] = '\0';
+    line_delete(line, start, end);
     line->point = start;
     line->mark = 0;
-    clear_line(line);
 }
 
 void delete_char(Line *line) {
     if (line->point < line->length) {
-        memmove(line->buffer + line->point,
-                line->buffer + line->point + 1,
-                line->length - line->point);
-
-        line->length--;
-        line->buffer[line->length] = '\0';
-        clear_line(line);
+        line_delete(line, line->point, line->point + 1);
     }
 }
 
@@ -177,25 +267,16 @@ void backward_delete_char(Line *line) {
     if (line->point > 0) {
         // Check if we're between a matching pair of delimiters
         if (line->point < line->length
-            && is_opening_delimiter(line->buffer[line->point - 1])
-            && is_matching_pair(line->buffer[line->point - 1], line->buffer[line->point])
+            && is_opening_delimiter(line_char_at(line, line->point - 1))
+            && is_matching_pair(line_char_at(line, line->point - 1),
+                                line_char_at(line, line->point))
             && electric_pair_mode) {
             
             // Delete both characters
-            memmove(line->buffer + line->point - 1, 
-                    line->buffer + line->point + 1,
-                    line->length - line->point - 1);
-            line->point--;
-            line->length -= 2;
-            line->buffer[line->length] = '\0';
+            line_delete(line, line->point - 1, line->point + 1);
         } else {
             // Normal single character deletion
-            memmove(line->buffer + line->point - 1, 
-                    line->buffer + line->point,
-                    line->length - line->point);
-            line->point--;
-            line->length--;
-            line->buffer[line->length] = '\0';
+            line_delete(line, line->point - 1, line->point);
         }
     }
 }
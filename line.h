@@ -2,33 +2,46 @@
 #define LINE_H
 
 #include <stdbool.h>
+#include "command_cache.h"
+#include "electric_pair_mode.h"
+#include "parser.h"
+#include "render.h"
 
-#define LINE_MAX 4096
-
-// TODO make this a dynamic array of chars (Buffer struct)
-// And keep the entire text in the terminal in a buffer 
-
-/* typedef struct { */
-/*     char buffer[LINE_MAX]; */
-/*     int length; */
-/*     int point; */
-/*     int mark; */
-/* } Line; */
+// The line is a gap buffer: text[0, gap_start) and text[gap_end, capacity)
+// hold the contents, and the gap is moved to wherever the next edit
+// happens, so typing at point never shifts the rest of the line.
+// There is no length limit; the buffer doubles when the gap runs out.
+// TODO keep the entire text in the terminal in a buffer
 
 typedef struct {
-    char buffer[LINE_MAX];
+    char *text;
+    int capacity;
+    int gap_start;
+    int gap_end;
     int length;
     int point;
     int mark;
-    char* current_command;  // Current partial command
-    bool is_valid_command;  // Whether current partial command matches anything
+    unsigned version;  // Bumped by every edit, so results can tell if they are stale
+    Ast *ast;           // The line parsed at ast_version
+    unsigned ast_version;
+    RenderSpan *spans;  // Its highlighting
+    int span_count;
+    DelimIndex delims;  // Delimiters in the line, split at the gap
 } Line;
 
-
-// Syntax Highlighting
-void init_command_cache(void);
-void free_command_cache(void);
-bool is_valid_partial_command(const char* partial);
+// Gap buffer primitives; edits keep point and mark on the same text
+void line_insert(Line *line, const char *text, int len);
+void line_delete(Line *line, int start, int end);
+void line_set(Line *line, const char *text, int len);
+void line_clear(Line *line);
+char line_char_at(const Line *line, int i);
+void line_copy(const Line *line, int start, int end, char *out);
+void line_segments(const Line *line, const char **before, int *before_len,
+                   const char **after, int *after_len);
+const char *line_text(Line *line);
+const DelimIndex *line_delimiters(Line *line);
+const Ast *line_ast(Line *line);
+void line_refresh_highlighting(Line *line);
 
 void clear_line(Line *line);
 void clear_screen(Line *line);
@@ -37,6 +50,8 @@ void kill_line(Line *line);
 void kill_region(Line *line);
 void delete_char(Line *line);
 void backward_delete_char(Line *line);
+void forward_list(Line *line);
+void backward_list(Line *line);
 
 
 void die(const char *error);
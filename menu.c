@@ -0,0 +1,205 @@
+#include "menu.h"
+#include "ansi_codes.h"
+#include "frame.h"
+#include <stdlib.h>
+#include <string.h>
+
+static struct {
+    bool active;
+    bool dirty;
+    CompletionList list;
+    int selected;        // -1 until the first move
+    int word_start;      // Where candidates go in the line
+    int word_len;        // Length of what is there now
+    char *original;      // The word before the menu opened
+    int original_len;
+    unsigned version;    // Of the line as the menu last left it
+
+    int skip;            // Leading bytes all candidates share up to a '/'
+
+    // Layout, for the terminal size it was computed for
+    int columns;
+    int rows;
+    int max_len;
+    int col_width;
+    int cols;
+    int total_rows;
+    int page_rows;
+    int height;          // Rows reserved below the prompt
+    int reserved;
+} menu;
+
+static void compute_layout(void) {
+    menu.columns = frame_columns();
+    menu.rows = frame_rows();
+
+    menu.col_width = menu.max_len + 2;
+    if (menu.col_width > menu.columns) menu.col_width = menu.columns;
+    menu.cols = menu.columns / menu.col_width;
+    if (menu.cols == 0) menu.cols = 1;
+    menu.total_rows = (menu.list.count + menu.cols - 1) / menu.cols;
+
+    // At most half the screen, so the prompt keeps some context above
+    int max_rows = menu.rows / 2 > 1 ? menu.rows / 2 : 1;
+    menu.page_rows = menu.total_rows < max_rows ? menu.total_rows : max_rows;
+    menu.height = menu.page_rows + (menu.total_rows > menu.page_rows);
+}
+
+void menu_open(Line *line, CompletionList *completions) {
+    if (menu.active) menu_close();
+
+    menu.list = *completions;
+    memset(completions, 0, sizeof(*completions));
+
+    const char *text = line_text(line);
+    menu.word_start = find_word_start(text, line->point);
+    menu.word_len = line->point - menu.word_start;
+
+    // Paths are shown without the directory they are all in
+    menu.skip = menu.word_len;
+    while (menu.skip > 0 && text[menu.word_start + menu.skip - 1] != '/') menu.skip--;
+    for (int i = 0; i < menu.list.count && menu.skip > 0; i++) {
+        if ((int)completion_item_len(&menu.list, i) < menu.skip
+            || memcmp(completion_item(&menu.list, i), text + menu.word_start, menu.skip) != 0) {
+            menu.skip = 0;
+        }
+    }
+
+    menu.max_len = 0;
+    for (int i = 0; i < menu.list.count; i++) {
+        int len = completion_item_len(&menu.list, i) - menu.skip;
+        if (len > menu.max_len) menu.max_len = len;
+    }
+    menu.original = strndup(text + menu.word_start, menu.word_len);
+    menu.original_len = menu.word_len;
+    menu.selected = -1;
+    menu.reserved = 0;
+    menu.version = line->version;
+    menu.active = true;
+    menu.dirty = true;
+    compute_layout();
+}
+
+bool menu_active(void) {
+    return menu.active;
+}
+
+static void replace_word(Line *line, const char *text, int len) {
+    line_delete(line, menu.word_start, menu.word_start + menu.word_len);
+    line->point = menu.word_start;
+    line_insert(line, text, len);
+    menu.word_len = len;
+    menu.version = line->version;
+}
+
+static void erase(void) {
+    if (menu.reserved == 0) return;
+    frame_puts(SAVE_CURSOR "\n\r" CLEAR_BELOW RESTORE_CURSOR);
+}
+
+static void finish(void) {
+    erase();
+    free_completion_list(&menu.list);
+    free(menu.original);
+    menu.original = NULL;
+    menu.active = false;
+}
+
+// The word range is only good for the text it was taken from; if the
+// line was edited behind the menu's back, the menu is given up
+static bool line_changed(const Line *line) {
+    if (line->version == menu.version) return false;
+    finish();
+    return true;
+}
+
+static void select_item(Line *line, int index) {
+    menu.selected = index;
+    replace_word(line, completion_item(&menu.list, index), completion_item_len(&menu.list, index));
+    menu.dirty = true;
+}
+
+void menu_move(Line *line, int delta) {
+    int count = menu.list.count;
+    if (line_changed(line) || count == 0) return;
+
+    int index;
+    if (menu.selected < 0) index = delta > 0 ? 0 : count - 1;
+    else index = ((menu.selected + delta) % count + count) % count;
+    select_item(line, index);
+}
+
+// Up and down stay in the same column, wrapping around the end
+void menu_move_row(Line *line, int delta) {
+    if (line_changed(line)) return;
+    if (menu.selected < 0) {
+        menu_move(line, delta);
+        return;
+    }
+    int col = menu.selected % menu.cols;
+    int row = ((menu.selected / menu.cols + delta) % menu.total_rows + menu.total_rows) % menu.total_rows;
+    int index = row * menu.cols + col;
+    if (index >= menu.list.count) index = delta > 0 ? col : menu.list.count - 1;
+    select_item(line, index);
+}
+
+// Keep the selected candidate in the line
+void menu_close(void) {
+    if (!menu.active) return;
+    finish();
+}
+
+// Put back the word as it was when the menu opened
+void menu_cancel(Line *line) {
+    if (!menu.active || line_changed(line)) return;
+    replace_word(line, menu.original, menu.original_len);
+    finish();
+}
+
+void menu_refresh(void) {
+    if (!menu.active) return;
+    if (menu.columns != frame_columns() || menu.rows != frame_rows()) {
+        compute_layout();
+        menu.reserved = 0;
+    }
+    menu.dirty = true;
+}
+
+void menu_draw(void) {
+    if (!menu.active || !menu.dirty) return;
+    menu.dirty = false;
+
+    // Make room below the prompt first: if that scrolls the screen, it
+    // has to happen before the cursor position is saved
+    if (menu.reserved < menu.height) {
+        for (int i = 0; i < menu.height; i++) frame_putc('\n');
+        frame_printf(CURSOR_UP_N, menu.height);
+        menu.reserved = menu.height;
+    }
+
+    int selected_row = menu.selected < 0 ? 0 : menu.selected / menu.cols;
+    int first_row = selected_row / menu.page_rows * menu.page_rows;
+
+    frame_puts(SAVE_CURSOR);
+    for (int r = 0; r < menu.page_rows; r++) {
+        frame_puts("\n\r" CLEAR_TO_EOL);
+        for (int c = 0; c < menu.cols; c++) {
+            int i = (first_row + r) * menu.cols + c;
+            if (i >= menu.list.count) break;
+
+            int len = completion_item_len(&menu.list, i) - menu.skip;
+            int shown = len < menu.col_width - 1 ? len : menu.col_width - 1;
+            if (i == menu.selected) frame_puts(REVERSE);
+            frame_append(completion_item(&menu.list, i) + menu.skip, shown);
+            if (i == menu.selected) frame_puts(COLOR_RESET);
+            frame_printf("%*s", menu.col_width - shown, "");
+        }
+    }
+    if (menu.height > menu.page_rows) {
+        int last = first_row + menu.page_rows;
+        if (last > menu.total_rows) last = menu.total_rows;
+        frame_printf("\n\r" CLEAR_TO_EOL DIM "rows %d-%d of %d (%d matches)" COLOR_RESET,
+                     first_row + 1, last, menu.total_rows, menu.list.count);
+    }
+    frame_puts(CLEAR_BELOW RESTORE_CURSOR);
+}
@@ -0,0 +1,23 @@
+#ifndef MENU_H
+#define MENU_H
+
+#include <stdbool.h>
+#include "completion.h"
+
+// Completion menu, drawn below the prompt row. Only the page holding
+// the selection is drawn, and the column layout is worked out once when
+// the menu opens (again only if the terminal is resized), so a redraw
+// costs the same for ten candidates or ten thousand.
+//
+// Moving the selection puts that candidate in place of the word.
+
+void menu_open(Line *line, CompletionList *completions);
+bool menu_active(void);
+void menu_move(Line *line, int delta);
+void menu_move_row(Line *line, int delta);
+void menu_close(void);
+void menu_cancel(Line *line);
+void menu_refresh(void);
+void menu_draw(void);
+
+#endif
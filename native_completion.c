@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include "native_completion.h"
+#include "command_cache.h"
+#include "completion_cache.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+extern char **environ;
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Names of the commands bash-completion has specs for, sorted
+static struct {
+    char **names;
+    int count;
+    int capacity;
+    bool loaded;
+} specs;
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void load_spec_dir(const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.') continue;
+        if (specs.count == specs.capacity) {
+            specs.capacity = specs.capacity ? specs.capacity * 2 : 256;
+            specs.names = realloc(specs.names, specs.capacity * sizeof(char *));
+            if (!specs.names) die("realloc");
+        }
+        specs.names[specs.count++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+}
+
+static void load_specs(void) {
+    specs.loaded = true;
+
+    char path[PATH_MAX];
+    const char *data_home = getenv("XDG_DATA_HOME");
+    const char *home = getenv("HOME");
+    if (data_home && *data_home) {
+        snprintf(path, sizeof(path), "%s/bash-completion/completions", data_home);
+        load_spec_dir(path);
+    } else if (home) {
+        snprintf(path, sizeof(path), "%s/.local/share/bash-completion/completions", home);
+        load_spec_dir(path);
+    }
+    load_spec_dir("/usr/local/share/bash-completion/completions");
+    load_spec_dir("/usr/share/bash-completion/completions");
+
+    qsort(specs.names, specs.count, sizeof(char *), compare_strings);
+}
+
+bool has_completion_spec(const char *command, int len) {
+    if (!specs.loaded) load_specs();
+    if (len <= 0 || len >= NAME_MAX) return false;
+
+    char name[NAME_MAX];
+    memcpy(name, command, len);
+    name[len] = '\0';
+    const char *key = name;
+    return bsearch(&key, specs.names, specs.count, sizeof(char *), compare_strings) != NULL;
+}
+
+static void complete_commands(const char *word, int len, CompletionList *completions) {
+    size_t first;
+    size_t count = command_cache_prefix_range(word, len, &first);
+    for (size_t i = first; i < first + count; i++) {
+        const char *name = command_cache_sorted_name(i);
+        completion_list_add(completions, name, strlen(name));
+    }
+
+    // Nothing starts with the word: rank every command by how well it matches
+    if (count == 0 && len > 0) {
+        for (size_t i = 0; i < command_cache_count(); i++) {
+            const char *name = command_cache_sorted_name(i);
+            completion_list_add(completions, name, strlen(name));
+        }
+        completion_list_rank(completions, word, len);
+    }
+}
+
+static void complete_variables(const char *word, int len, CompletionList *completions) {
+    // word includes the '$'
+    for (char **env = environ; *env; env++) {
+        const char *eq = strchr(*env, '=');
+        if (!eq) continue;
+        int name_len = eq - *env;
+        if (name_len < len - 1 || strncmp(*env, word + 1, len - 1) != 0) continue;
+        completion_list_append(completions, "$", 1);
+        completion_list_append(completions, *env, name_len);
+        completion_list_finish(completions);
+    }
+}
+
+// Every entry of dir_path starting with prefix, hidden ones included,
+// each written as the word's directory part followed by the name
+static void read_dir(const char *dir_path, const char *word, int base,
+                     const char *prefix, int prefix_len, bool executables_only,
+                     CompletionList *completions) {
+    int fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    char buf[32768];
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (long pos = 0; pos < n;) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(buf + pos);
+            pos += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+            if (strncmp(name, prefix, prefix_len) != 0) continue;
+
+            // Only links and file systems without d_type need a stat
+            bool is_dir = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+                struct stat st;
+                is_dir = fstatat(fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (executables_only && !is_dir && faccessat(fd, name, X_OK, 0) != 0) continue;
+
+            completion_list_append(completions, word, base);
+            completion_list_append(completions, name, strlen(name));
+            if (is_dir) completion_list_append(completions, "/", 1);
+            completion_list_finish(completions);
+        }
+    }
+    close(fd);
+
+    completion_list_sort(completions);
+}
+
+// Files in the word's directory starting with its last component.
+// Directories get a trailing '/'; with executables_only, other files
+// must be executable. Hidden files only show up once the word asks
+// for them with a leading '.'.
+static void complete_paths(const CompletionKey *key, bool executables_only,
+                           CompletionList *completions) {
+    const char *word = key->prefix;
+    int len = key->prefix_len;
+    int base = len;
+    while (base > 0 && word[base - 1] != '/') base--;
+    const char *prefix = word + base;
+    int prefix_len = len - base;
+
+    // Directory to read, with a leading ~/ expanded
+    char dir_path[PATH_MAX];
+    if (base == 0) {
+        strcpy(dir_path, ".");
+    } else if (word[0] == '~' && (base == 1 || word[1] == '/')) {
+        const char *home = getenv("HOME");
+        if (!home) return;
+        snprintf(dir_path, sizeof(dir_path), "%s%.*s", home, base - 1, word + 1);
+    } else {
+        snprintf(dir_path, sizeof(dir_path), "%.*s", base, word);
+    }
+
+    CompletionList candidates = {0};
+    if (!completion_cache_lookup(key, dir_path, &candidates)) {
+        read_dir(dir_path, word, base, prefix, prefix_len, executables_only, &candidates);
+        completion_cache_store(key, dir_path, &candidates);
+    }
+
+    // Nothing starts with the word: take the whole directory, ranked
+    bool fuzzy = candidates.count == 0 && prefix_len > 0;
+    if (fuzzy) {
+        CompletionKey dir_key = *key;
+        dir_key.prefix_len = base;
+        if (!completion_cache_lookup(&dir_key, dir_path, &candidates)) {
+            read_dir(dir_path, word, base, "", 0, executables_only, &candidates);
+            completion_cache_store(&dir_key, dir_path, &candidates);
+        }
+    }
+
+    bool show_hidden = prefix_len > 0 && prefix[0] == '.';
+    for (int i = 0; i < candidates.count; i++) {
+        const char *item = completion_item(&candidates, i);
+        if (item[base] == '.' && !show_hidden) continue;
+        completion_list_add(completions, item, completion_item_len(&candidates, i));
+    }
+    free_completion_list(&candidates);
+
+    if (fuzzy) completion_list_rank(completions, word, len);
+}
+
+void native_complete_paths(const char *line, int point, const char *cwd,
+                           CompletionList *completions) {
+    CompletionKey key;
+    completion_key_init(&key, line, point, cwd);
+    complete_paths(&key, key.arg_index == 0, completions);
+}
+
+bool native_complete(const char *line, int point, const char *cwd,
+                     CompletionList *completions) {
+    CompletionKey key;
+    completion_key_init(&key, line, point, cwd);
+    const char *word = key.prefix;
+    int len = key.prefix_len;
+
+    if (len > 0 && word[0] == '$') {
+        complete_variables(word, len, completions);
+        completion_list_sort(completions);
+        return true;
+    }
+
+    // First word: a command name, or a path to one
+    if (key.arg_index == 0) {
+        if (memchr(word, '/', len)) complete_paths(&key, true, completions);
+        else complete_commands(word, len, completions);
+        return true;
+    }
+
+    if (has_completion_spec(key.command, key.command_len)) return false;
+
+    complete_paths(&key, false, completions);
+    return true;
+}
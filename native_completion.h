@@ -0,0 +1,22 @@
+#ifndef NATIVE_COMPLETION_H
+#define NATIVE_COMPLETION_H
+
+#include <stdbool.h>
+#include "completion.h"
+
+// In-process completion for the cases that need no fork: command names
+// from the command cache, paths read straight from the directory, and
+// $VAR names from the environment. Returns false when the word belongs
+// to a command with its own bash completion spec, so the caller should
+// ask bash instead.
+bool native_complete(const char *line, int point, const char *cwd,
+                     CompletionList *completions);
+
+// Just the paths matching the word at point, whatever the command
+void native_complete_paths(const char *line, int point, const char *cwd,
+                           CompletionList *completions);
+
+// Whether bash-completion ships a spec for this command
+bool has_completion_spec(const char *command, int len);
+
+#endif
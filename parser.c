@@ -0,0 +1,531 @@
+#include "parser.h"
+#include "builtin.h"
+#include "line.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    LEX_WORD,
+    LEX_OPERATOR,
+    LEX_REDIRECT,
+    LEX_END,
+} LexKind;
+
+typedef struct {
+    LexKind kind;
+    int start;
+    int end;
+    RedirectKind redirect;
+    int fd;
+} Lexeme;
+
+typedef struct {
+    Ast *ast;
+    Lexeme *lexemes;
+    int count;
+    int capacity;
+    int pos;
+} Parser;
+
+// Reserved words only mean something to sh in command position
+static const char *keywords[] = {
+    "if", "then", "else", "elif", "fi", "do", "done", "case", "esac", "while", "until",
+    "for", "in", "function", "select", "{", "}", "[[", "]]", "time", "coproc",
+};
+
+// Keywords after which a command is expected again, for highlighting
+static const char *leading_keywords[] = {
+    "if", "then", "else", "elif", "do", "while", "until", "time", "{",
+};
+
+// sh builtins that have no binary to fall back on
+static const char *sh_builtins[] = {
+    ".", "alias", "command", "eval", "exec", "exit", "fc", "getopts", "local", "read",
+    "readonly", "return", "set", "shift", "source", "times", "trap", "ulimit", "umask",
+    "unalias", "wait",
+};
+
+static bool name_in(const char *name, const char **names, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) return true;
+    }
+    return false;
+}
+
+bool is_keyword(const char *name) {
+    return name_in(name, keywords, sizeof(keywords) / sizeof(*keywords));
+}
+
+bool is_sh_builtin(const char *name) {
+    return name_in(name, sh_builtins, sizeof(sh_builtins) / sizeof(*sh_builtins));
+}
+
+static void *grow(void *items, int *capacity, int count, size_t size) {
+    if (count < *capacity) return items;
+    *capacity = *capacity ? *capacity * 2 : 8;
+    items = realloc(items, *capacity * size);
+    if (!items) die("realloc");
+    return items;
+}
+
+static int add_token(Ast *ast, int start, int end, TokenKind kind) {
+    ast->tokens = grow(ast->tokens, &ast->token_capacity, ast->token_count, sizeof(AstToken));
+    ast->tokens[ast->token_count] = (AstToken){ start, end, kind };
+    return ast->token_count++;
+}
+
+static void fail(Ast *ast, const char *error, int at) {
+    if (ast->error) return;
+    ast->error = error;
+    ast->error_at = at;
+}
+
+bool token_is_part(TokenKind kind) {
+    return kind == TOKEN_STRING || kind == TOKEN_VARIABLE;
+}
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static bool ends_word(char c) {
+    return is_blank(c) || strchr("|&;()<>\n", c);
+}
+
+static bool is_name_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static bool is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// `...` from its opening quote; returns the index after it
+static int scan_backquote(Ast *ast, int i) {
+    int start = i++;
+    while (i < ast->length && ast->text[i] != '`') i += ast->text[i] == '\\' ? 2 : 1;
+    if (i >= ast->length) {
+        fail(ast, "unterminated `", start);
+        i = ast->length;
+    } else {
+        i++;
+    }
+    ast->needs_sh = true;
+    add_token(ast, start, i, TOKEN_VARIABLE);
+    return i;
+}
+
+// An expansion starting at a '$'. Only $NAME, ${NAME}, $? and $$ are
+// done natively.
+static int scan_dollar(Ast *ast, int i) {
+    const char *s = ast->text;
+    int n = ast->length;
+    int start = i++;
+
+    if (i < n && s[i] == '(') {
+        int depth = 0;
+        for (; i < n; i++) {
+            if (s[i] == '\\') i++;
+            else if (s[i] == '(') depth++;
+            else if (s[i] == ')' && --depth == 0) break;
+        }
+        if (i >= n) {
+            fail(ast, "unterminated $(", start);
+            i = n;
+        } else {
+            i++;
+        }
+        ast->needs_sh = true;
+    } else if (i < n && s[i] == '{') {
+        int name = ++i;
+        while (i < n && s[i] != '}') i++;
+        if (i >= n) {
+            fail(ast, "unterminated ${", start);
+            i = n;
+        } else {
+            bool plain = i > name && is_name_start(s[name]);
+            for (int j = name; j < i && plain; j++) plain = is_name_char(s[j]);
+            if (!plain) ast->needs_sh = true;
+            i++;
+        }
+    } else if (i < n && is_name_start(s[i])) {
+        while (i < n && is_name_char(s[i])) i++;
+    } else if (i < n && (s[i] == '?' || s[i] == '$')) {
+        i++;
+    } else if (i < n && (isdigit((unsigned char)s[i]) || strchr("#@*!-", s[i]))) {
+        ast->needs_sh = true;  // Positional and the rarer special parameters
+        i++;
+    } else {
+        return i;  // A lone $ is literal
+    }
+    add_token(ast, start, i, TOKEN_VARIABLE);
+    return i;
+}
+
+static int scan_word(Ast *ast, int i) {
+    const char *s = ast->text;
+    int n = ast->length;
+    while (i < n && !ends_word(s[i])) {
+        int start = i;
+        switch (s[i]) {
+        case '\\':
+            i += i + 1 < n ? 2 : 1;
+            break;
+        case '\'':
+            i++;
+            while (i < n && s[i] != '\'') i++;
+            if (i >= n) fail(ast, "unterminated '", start);
+            else i++;
+            add_token(ast, start, i, TOKEN_STRING);
+            break;
+        case '"': {
+            // Added first, so expansions inside are drawn over it
+            int token = add_token(ast, start, n, TOKEN_STRING);
+            i++;
+            while (i < n && s[i] != '"') {
+                if (s[i] == '\\') i += 2;
+                else if (s[i] == '$') i = scan_dollar(ast, i);
+                else if (s[i] == '`') i = scan_backquote(ast, i);
+                else i++;
+            }
+            if (i >= n) {
+                fail(ast, "unterminated \"", start);
+                i = n;
+            } else {
+                i++;
+            }
+            ast->tokens[token].end = i;
+            break;
+        }
+        case '$':
+            i = scan_dollar(ast, i);
+            break;
+        case '`':
+            i = scan_backquote(ast, i);
+            break;
+        default:
+            i++;
+            break;
+        }
+    }
+    return i;
+}
+
+static void add_lexeme(Parser *p, Lexeme lexeme) {
+    p->lexemes = grow(p->lexemes, &p->capacity, p->count, sizeof(Lexeme));
+    p->lexemes[p->count++] = lexeme;
+}
+
+static int scan_redirect(Parser *p, int start, int i) {
+    Ast *ast = p->ast;
+    const char *s = ast->text;
+    int n = ast->length;
+    bool input = s[i] == '<';
+    Lexeme lexeme = { LEX_REDIRECT, start, 0, input ? REDIRECT_INPUT : REDIRECT_OUTPUT, input ? 0 : 1 };
+    if (start < i) lexeme.fd = atoi(s + start);
+    i++;
+
+    if (i < n && s[i] == '&') {
+        lexeme.redirect = REDIRECT_DUP;
+        i++;
+    } else if (!input && i < n && s[i] == '>') {
+        lexeme.redirect = REDIRECT_APPEND;
+        i++;
+    } else if (!input && i < n && s[i] == '|') {
+        i++;
+    } else if (input && i < n && s[i] == '>') {
+        lexeme.redirect = REDIRECT_READ_WRITE;
+        i++;
+    } else if (input && i < n && s[i] == '<') {
+        // Here-documents and here-strings
+        ast->needs_sh = true;
+        while (i < n && (s[i] == '<' || s[i] == '-')) i++;
+    }
+    lexeme.end = i;
+    add_token(ast, start, i, TOKEN_REDIRECT);
+    add_lexeme(p, lexeme);
+    return i;
+}
+
+static void lex(Parser *p) {
+    Ast *ast = p->ast;
+    const char *s = ast->text;
+    int n = ast->length;
+    static const char *operators[] = { "&&", "||", ";;", "|", "&", ";", "(", ")", "\n" };
+
+    for (int i = 0; i < n;) {
+        if (is_blank(s[i])) {
+            i++;
+            continue;
+        }
+        if (s[i] == '#') {
+            add_token(ast, i, n, TOKEN_COMMENT);
+            break;
+        }
+
+        int digits = i;
+        while (digits < n && isdigit((unsigned char)s[digits])) digits++;
+        if (digits < n && (s[digits] == '<' || s[digits] == '>')) {
+            i = scan_redirect(p, i, digits);
+            continue;
+        }
+
+        const char *op = NULL;
+        for (size_t k = 0; k < sizeof(operators) / sizeof(*operators) && !op; k++) {
+            size_t len = strlen(operators[k]);
+            if (strncmp(s + i, operators[k], len) == 0) op = operators[k];
+        }
+        if (op) {
+            int len = strlen(op);
+            if (strcmp(op, ";;") == 0) ast->needs_sh = true;
+            if (*op != '\n') add_token(ast, i, i + len, TOKEN_OPERATOR);
+            add_lexeme(p, (Lexeme){ LEX_OPERATOR, i, i + len, 0, 0 });
+            i += len;
+            continue;
+        }
+
+        int end = scan_word(ast, i);
+        add_lexeme(p, (Lexeme){ LEX_WORD, i, end, 0, 0 });
+        i = end;
+    }
+    add_lexeme(p, (Lexeme){ LEX_END, n, n, 0, 0 });
+}
+
+static const Lexeme *peek(const Parser *p) {
+    return &p->lexemes[p->pos];
+}
+
+static bool is_operator(const Parser *p, const char *op) {
+    const Lexeme *l = peek(p);
+    return l->kind == LEX_OPERATOR && (int)strlen(op) == l->end - l->start
+        && memcmp(p->ast->text + l->start, op, l->end - l->start) == 0;
+}
+
+static bool accept(Parser *p, const char *op) {
+    if (!is_operator(p, op)) return false;
+    p->pos++;
+    return true;
+}
+
+static void skip_newlines(Parser *p) {
+    while (accept(p, "\n")) {}
+}
+
+static bool word_is(const Ast *ast, const Lexeme *l, const char *word) {
+    return (int)strlen(word) == l->end - l->start && memcmp(ast->text + l->start, word, l->end - l->start) == 0;
+}
+
+static bool word_in(const Ast *ast, const Lexeme *l, const char **list, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (word_is(ast, l, list[i])) return true;
+    }
+    return false;
+}
+
+static bool is_assignment(const Ast *ast, const Lexeme *l) {
+    const char *s = ast->text;
+    if (!is_name_start(s[l->start])) return false;
+    for (int i = l->start; i < l->end; i++) {
+        if (s[i] == '=') return true;
+        if (!is_name_char(s[i])) return false;
+    }
+    return false;
+}
+
+static int add_node(Ast *ast, NodeKind kind, int left, int right) {
+    ast->nodes = grow(ast->nodes, &ast->node_capacity, ast->node_count, sizeof(AstNode));
+    ast->nodes[ast->node_count] = (AstNode){ .kind = kind, .left = left, .right = right };
+    return ast->node_count++;
+}
+
+// Gives node the range from start to the end of the last lexeme taken
+static int spanning(Parser *p, int node, int start) {
+    if (node < 0) return node;
+    p->ast->nodes[node].start = start;
+    p->ast->nodes[node].end = p->lexemes[p->pos - 1].end;
+    return node;
+}
+
+static void unexpected(Parser *p) {
+    fail(p->ast, peek(p)->kind == LEX_END ? "unexpected end of line" : "unexpected token",
+         peek(p)->start);
+}
+
+static bool parse_redirect(Parser *p, int node) {
+    Ast *ast = p->ast;
+    const Lexeme *op = peek(p);
+    if (op->kind != LEX_REDIRECT) return false;
+    p->pos++;
+    const Lexeme *target = peek(p);
+    if (target->kind != LEX_WORD) {
+        unexpected(p);
+        return false;
+    }
+    p->pos++;
+    add_token(ast, target->start, target->end, TOKEN_WORD);
+
+    ast->redirects = grow(ast->redirects, &ast->redirect_capacity, ast->redirect_count,
+                          sizeof(AstRedirect));
+    ast->redirects[ast->redirect_count++] =
+        (AstRedirect){ op->redirect, op->fd, { target->start, target->end } };
+    ast->nodes[node].redirect_count++;
+    return true;
+}
+
+static int parse_list(Parser *p, bool nested);
+
+static int parse_command(Parser *p) {
+    Ast *ast = p->ast;
+    int start = peek(p)->start;
+
+    if (accept(p, "(")) {
+        int body = parse_list(p, true);
+        if (ast->error) return -1;
+        if (body < 0 || !accept(p, ")")) {
+            unexpected(p);
+            return -1;
+        }
+        int node = add_node(ast, NODE_SUBSHELL, body, -1);
+        ast->nodes[node].first_redirect = ast->redirect_count;
+        while (parse_redirect(p, node)) {}
+        return ast->error ? -1 : spanning(p, node, start);
+    }
+
+    int node = add_node(ast, NODE_COMMAND, -1, -1);
+    ast->nodes[node].first_word = ast->word_count;
+    ast->nodes[node].first_redirect = ast->redirect_count;
+    bool command_position = true;
+    for (;;) {
+        if (parse_redirect(p, node)) continue;
+        if (ast->error) return -1;
+        const Lexeme *l = peek(p);
+        if (l->kind != LEX_WORD) break;
+        p->pos++;
+
+        AstNode *command = &ast->nodes[node];
+        TokenKind kind = TOKEN_WORD;
+        if (command_position) {
+            if (is_assignment(ast, l)) {
+                if (command->word_count == command->assignment_count) command->assignment_count++;
+                kind = TOKEN_ASSIGNMENT;
+            } else if (word_in(ast, l, keywords, sizeof(keywords) / sizeof(*keywords))) {
+                ast->needs_sh = true;
+                kind = TOKEN_KEYWORD;
+                command_position = word_in(ast, l, leading_keywords,
+                                           sizeof(leading_keywords) / sizeof(*leading_keywords));
+            } else {
+                command_position = false;
+                char name[32];
+                int len = l->end - l->start;
+                if (len < (int)sizeof(name)) {
+                    memcpy(name, ast->text + l->start, len);
+                    name[len] = '\0';
+                    if (!is_builtin(name)
+                        && word_in(ast, l, sh_builtins, sizeof(sh_builtins) / sizeof(*sh_builtins))) {
+                        ast->needs_sh = true;
+                    }
+                }
+                kind = TOKEN_COMMAND;
+            }
+        }
+        add_token(ast, l->start, l->end, kind);
+        ast->words = grow(ast->words, &ast->word_capacity, ast->word_count, sizeof(AstWord));
+        ast->words[ast->word_count++] = (AstWord){ l->start, l->end };
+        command->word_count++;
+    }
+
+    AstNode *command = &ast->nodes[node];
+    if (command->word_count == 0 && command->redirect_count == 0) {
+        unexpected(p);
+        return -1;
+    }
+    // Setting shell variables needs a shell that outlives the line
+    if (command->word_count == command->assignment_count) ast->needs_sh = true;
+    return spanning(p, node, start);
+}
+
+static int parse_pipeline(Parser *p) {
+    Ast *ast = p->ast;
+    int start = peek(p)->start;
+    bool negate = false;
+    if (peek(p)->kind == LEX_WORD && word_is(ast, peek(p), "!")) {
+        add_token(ast, peek(p)->start, peek(p)->end, TOKEN_KEYWORD);
+        p->pos++;
+        negate = true;
+    }
+
+    int left = parse_command(p);
+    while (left >= 0 && accept(p, "|")) {
+        skip_newlines(p);
+        int right = parse_command(p);
+        if (right < 0) return -1;
+        left = spanning(p, add_node(ast, NODE_PIPE, left, right), start);
+    }
+    if (left >= 0 && negate) left = spanning(p, add_node(ast, NODE_NOT, left, -1), start);
+    return left;
+}
+
+static int parse_and_or(Parser *p) {
+    int start = peek(p)->start;
+    int left = parse_pipeline(p);
+    while (left >= 0) {
+        NodeKind kind;
+        if (accept(p, "&&")) kind = NODE_AND;
+        else if (accept(p, "||")) kind = NODE_OR;
+        else break;
+        skip_newlines(p);
+        int right = parse_pipeline(p);
+        if (right < 0) return -1;
+        left = spanning(p, add_node(p->ast, kind, left, right), start);
+    }
+    return left;
+}
+
+static int parse_list(Parser *p, bool nested) {
+    Ast *ast = p->ast;
+    int list = -1;
+    for (;;) {
+        skip_newlines(p);
+        if (peek(p)->kind == LEX_END || (nested && is_operator(p, ")"))) break;
+
+        int item = parse_and_or(p);
+        if (item < 0) return -1;
+        bool more = true;
+        if (accept(p, "&")) {
+            item = add_node(ast, NODE_BACKGROUND, item, -1);
+        } else if (!accept(p, ";") && !accept(p, "\n")) {
+            more = false;
+        }
+        list = list < 0 ? item : add_node(ast, NODE_SEQUENCE, list, item);
+        if (!more) break;
+    }
+    return list;
+}
+
+Ast *ast_parse(const char *text, int length) {
+    Ast *ast = calloc(1, sizeof(Ast));
+    if (!ast) die("calloc");
+    ast->text = malloc(length + 1);
+    if (!ast->text) die("malloc");
+    memcpy(ast->text, text, length);
+    ast->text[length] = '\0';
+    ast->length = length;
+
+    Parser p = { .ast = ast };
+    lex(&p);
+    ast->root = parse_list(&p, false);
+    if (!ast->error && peek(&p)->kind != LEX_END) unexpected(&p);
+    free(p.lexemes);
+    return ast;
+}
+
+void ast_free(Ast *ast) {
+    if (!ast) return;
+    free(ast->text);
+    free(ast->nodes);
+    free(ast->words);
+    free(ast->redirects);
+    free(ast->tokens);
+    free(ast);
+}
@@ -0,0 +1,110 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stdbool.h>
+
+// Command line parser.
+// Handles simple commands with assignments and redirections, pipelines,
+// `!`, `&&`, `||`, `;`, `&` and ( subshells ). The tree is kept in flat
+// arrays that refer to the line by byte offsets; words are stored as
+// written, quotes and all, and only expanded when they are run.
+//
+// Anything beyond that (command substitution, here-documents, keywords,
+// functions, sh builtins we do not have) sets needs_sh: the line is
+// still tokenized for highlighting, but /bin/sh runs it.
+
+typedef enum {
+    TOKEN_COMMAND,     // First word of a simple command
+    TOKEN_KEYWORD,     // if, for, ... and `!` in command position
+    TOKEN_WORD,
+    TOKEN_ASSIGNMENT,
+    TOKEN_OPERATOR,    // | && || ; & ( )
+    TOKEN_REDIRECT,    // The operator with its fd, not the target
+    TOKEN_STRING,      // A quoted part of a word
+    TOKEN_VARIABLE,    // $NAME, ${NAME}, $?, and $(...) or `...`
+    TOKEN_COMMENT,
+} TokenKind;
+
+typedef struct {
+    int start;  // Byte range in the line
+    int end;
+    TokenKind kind;
+} AstToken;
+
+typedef struct {
+    int start;
+    int end;
+} AstWord;
+
+typedef enum {
+    REDIRECT_INPUT,       // <
+    REDIRECT_OUTPUT,      // > and >|
+    REDIRECT_APPEND,      // >>
+    REDIRECT_READ_WRITE,  // <>
+    REDIRECT_DUP,         // <& and >&; the target is an fd or -
+} RedirectKind;
+
+typedef struct {
+    RedirectKind kind;
+    int fd;
+    AstWord target;
+} AstRedirect;
+
+typedef enum {
+    NODE_COMMAND,
+    NODE_SUBSHELL,    // left is the body
+    NODE_NOT,         // left
+    NODE_PIPE,        // left | right
+    NODE_AND,
+    NODE_OR,
+    NODE_SEQUENCE,    // left ; right
+    NODE_BACKGROUND,  // left &
+} NodeKind;
+
+typedef struct {
+    NodeKind kind;
+    int left;
+    int right;
+    int first_word;        // NODE_COMMAND: words, assignments first
+    int word_count;
+    int assignment_count;
+    int first_redirect;    // NODE_COMMAND and NODE_SUBSHELL
+    int redirect_count;
+    int start;             // Byte range of the node in the line, which
+    int end;               // names the job it runs as
+} AstNode;
+
+typedef struct {
+    char *text;
+    int length;
+    AstNode *nodes;
+    int node_count;
+    int node_capacity;
+    AstWord *words;
+    int word_count;
+    int word_capacity;
+    AstRedirect *redirects;
+    int redirect_count;
+    int redirect_capacity;
+    AstToken *tokens;      // In line order within each kind of pass
+    int token_count;
+    int token_capacity;
+    int root;              // -1 for a line with no commands
+    const char *error;     // Syntax error, or NULL
+    int error_at;
+    bool needs_sh;
+} Ast;
+
+Ast *ast_parse(const char *text, int length);
+
+// Reserved words, and the sh builtins that lines using them are sent to
+// /bin/sh for
+bool is_keyword(const char *name);
+bool is_sh_builtin(const char *name);
+void ast_free(Ast *ast);
+
+// Whether a token is part of a word (strings, variables) and so should
+// be drawn over the word's own color
+bool token_is_part(TokenKind kind);
+
+#endif
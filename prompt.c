@@ -4,33 +4,83 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 int status = 0;
 
-void draw_prompt(int status) {
-    char hostname[MAX_HOSTNAME];
+// The prompt is rendered once and kept until something it shows can
+// have changed: the directory (cd), the environment (HOME), the host
+// name, or whether the last exit status was zero.
+typedef struct {
+    char text[MAX_USERNAME + MAX_HOSTNAME + MAX_PATH + 64];
     char username[MAX_USERNAME];
+    char hostname[MAX_HOSTNAME];
     char path[MAX_PATH];
-    
-    // Get username
-    if (getlogin_r(username, sizeof(username)) != 0) {
-        strncpy(username, "unknown", sizeof(username));
+    bool have_identity;
+    bool have_path;
+    bool valid;
+    bool failed;  // Status the text was rendered for was non-zero
+} PromptCache;
+
+static PromptCache prompt = {0};
+
+// Shown instead of the prompt while set, e.g. by incremental search
+static const char *override;
+
+static void read_hostname(char *hostname, size_t size) {
+    if (gethostname(hostname, size) != 0) {
+        strncpy(hostname, "unknown", size);
     }
-    
-    // Get hostname
-    if (gethostname(hostname, sizeof(hostname)) != 0) {
-        strncpy(hostname, "unknown", sizeof(hostname));
+    hostname[size - 1] = '\0';
+}
+
+void prompt_override(const char *text) {
+    override = text;
+}
+
+void prompt_invalidate(void) {
+    prompt.have_path = false;
+    prompt.valid = false;
+}
+
+// Called after external commands, which are the only way the host
+// name can change under us
+void prompt_refresh_host(void) {
+    char hostname[MAX_HOSTNAME];
+    read_hostname(hostname, sizeof(hostname));
+    if (strcmp(hostname, prompt.hostname) != 0) {
+        memcpy(prompt.hostname, hostname, sizeof(hostname));
+        prompt.valid = false;
     }
-    
-    // Get current directory
-    get_current_dir(path, sizeof(path));
-    
-    // Print prompt with colors
-    printf("\r" CLEAR_LINE);  // Clear the line first
-    printf(GREEN "%s@%s" COLOR_RESET " ", username, hostname);
-    printf(BLUE "%s" COLOR_RESET " ", path);
-    printf("%s" "λ" COLOR_RESET " ", status == 0 ? GREEN : RED);
-    fflush(stdout);
+}
+
+// Format the prompt; the result lives in a static buffer
+const char *prompt_string(int status) {
+    if (override) return override;
+    if (prompt.valid && prompt.failed == (status != 0)) return prompt.text;
+
+    if (!prompt.have_identity) {
+        // Get username
+        if (getlogin_r(prompt.username, sizeof(prompt.username)) != 0) {
+            strncpy(prompt.username, "unknown", sizeof(prompt.username));
+        }
+        read_hostname(prompt.hostname, sizeof(prompt.hostname));
+        prompt.have_identity = true;
+    }
+
+    if (!prompt.have_path) {
+        get_current_dir(prompt.path, sizeof(prompt.path));
+        prompt.have_path = true;
+    }
+
+    snprintf(prompt.text, sizeof(prompt.text),
+             GREEN "%s@%s" COLOR_RESET " "
+             BLUE "%s" COLOR_RESET " "
+             "%s" "λ" COLOR_RESET " ",
+             prompt.username, prompt.hostname, prompt.path, status == 0 ? GREEN : RED);
+    prompt.failed = status != 0;
+    prompt.valid = true;
+    return prompt.text;
 }
 
 void get_current_dir(char *path, size_t size) {
@@ -9,7 +9,10 @@
 
 extern int status;
 
-void draw_prompt(int status);
+const char *prompt_string(int status);
+void prompt_invalidate(void);
+void prompt_override(const char *text);
+void prompt_refresh_host(void);
 void get_current_dir(char *path, size_t size);
 
 #endif
@@ -0,0 +1,181 @@
+#include "render.h"
+#include "ansi_codes.h"
+#include "line.h"
+#include "frame.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Colors are stored per byte as an index into `palette`, so two
+// renders can be compared with plain byte loops.
+#define PALETTE_MAX 16
+
+typedef struct {
+    bool valid;
+    char *prompt;
+    char *text;
+    unsigned char *attrs;
+    int length;
+    int text_capacity;
+    int attrs_capacity;
+    int cursor;  // Column of the terminal cursor, relative to the text
+} Screen;
+
+static Screen screen = {0};
+static const char *palette[PALETTE_MAX] = { NULL };
+static int palette_count = 1;  // 0 is the default color
+
+// The frame being rendered; swapped with the model once it is drawn
+static char *next_text = NULL;
+static unsigned char *next_attrs = NULL;
+static int next_text_capacity = 0;
+static int next_attrs_capacity = 0;
+
+static unsigned char color_index(const char *color) {
+    if (!color) return 0;
+    for (int i = 1; i < palette_count; i++) {
+        if (palette[i] == color || strcmp(palette[i], color) == 0) return i;
+    }
+    if (palette_count == PALETTE_MAX) return 0;
+    palette[palette_count] = color;
+    return palette_count++;
+}
+
+static void *reserve(void *buffer, int *capacity, int size) {
+    if (size <= *capacity) return buffer;
+    int new_capacity = *capacity ? *capacity : 256;
+    while (new_capacity < size) new_capacity *= 2;
+    buffer = realloc(buffer, new_capacity);
+    if (!buffer) die("realloc");
+    *capacity = new_capacity;
+    return buffer;
+}
+
+// Terminal columns taken by text[from, to), counting UTF-8 lead bytes
+static int columns(const char *text, int from, int to) {
+    int cols = 0;
+    for (int i = from; i < to; i++) {
+        if (((unsigned char)text[i] & 0xC0) != 0x80) cols++;
+    }
+    return cols;
+}
+
+static void move_cursor(int from, int to) {
+    if (to < from) {
+        if (from - to == 1) frame_puts(CURSOR_LEFT);
+        else frame_printf(CURSOR_LEFT_N, from - to);
+    } else if (to > from) {
+        if (to - from == 1) frame_puts(CURSOR_RIGHT);
+        else frame_printf(CURSOR_RIGHT_N, to - from);
+    }
+}
+
+static void write_span(const char *text, const unsigned char *attr, int from, int to) {
+    int current = 0;
+    while (from < to) {
+        int run = from + 1;
+        while (run < to && attr[run] == attr[from]) run++;
+        if (attr[from] != current) {
+            frame_puts(attr[from] ? palette[attr[from]] : COLOR_RESET);
+            current = attr[from];
+        }
+        frame_append(text + from, run - from);
+        from = run;
+    }
+    if (current != 0) frame_puts(COLOR_RESET);
+}
+
+#define SWAP(type, a, b) do { type tmp_ = (a); (a) = (b); (b) = tmp_; } while (0)
+
+static void save_model(const char *prompt, int length, int cursor) {
+    if (!screen.prompt || strcmp(screen.prompt, prompt) != 0) {
+        free(screen.prompt);
+        screen.prompt = strdup(prompt);
+    }
+    SWAP(char *, screen.text, next_text);
+    SWAP(unsigned char *, screen.attrs, next_attrs);
+    SWAP(int, screen.text_capacity, next_text_capacity);
+    SWAP(int, screen.attrs_capacity, next_attrs_capacity);
+    screen.length = length;
+    screen.cursor = cursor;
+    screen.valid = true;
+}
+
+void render_invalidate(void) {
+    screen.valid = false;
+}
+
+void render_line(const char *prompt, const char *before, int before_len,
+                 const char *after, int after_len, int point,
+                 const RenderSpan *spans, int span_count) {
+    int length = before_len + after_len;
+    next_text = reserve(next_text, &next_text_capacity, length + 1);
+    if (before_len) memcpy(next_text, before, before_len);
+    if (after_len) memcpy(next_text + before_len, after, after_len);
+
+    next_attrs = reserve(next_attrs, &next_attrs_capacity, length + 1);
+    memset(next_attrs, 0, length);
+    for (int i = 0; i < span_count; i++) {
+        int start = spans[i].start < 0 ? 0 : spans[i].start;
+        int end = spans[i].end > length ? length : spans[i].end;
+        if (start < end) memset(next_attrs + start, color_index(spans[i].color), end - start);
+    }
+
+    int point_col = columns(next_text, 0, point);
+
+    if (!screen.valid || strcmp(screen.prompt, prompt) != 0) {
+        frame_puts("\r" CLEAR_LINE);
+        frame_puts(prompt);
+        write_span(next_text, next_attrs, 0, length);
+        move_cursor(columns(next_text, 0, length), point_col);
+        save_model(prompt, length, point_col);
+        return;
+    }
+
+    // Longest common prefix and suffix of (byte, color) pairs
+    int old_length = screen.length;
+    int shortest = old_length < length ? old_length : length;
+    int prefix = 0;
+    while (prefix < shortest && screen.text[prefix] == next_text[prefix]
+           && screen.attrs[prefix] == next_attrs[prefix]) {
+        prefix++;
+    }
+    // Never split a UTF-8 sequence
+    while (prefix > 0 && prefix < length && ((unsigned char)next_text[prefix] & 0xC0) == 0x80) {
+        prefix--;
+    }
+
+    int suffix = 0;
+    while (suffix < shortest - prefix
+           && screen.text[old_length - 1 - suffix] == next_text[length - 1 - suffix]
+           && screen.attrs[old_length - 1 - suffix] == next_attrs[length - 1 - suffix]) {
+        suffix++;
+    }
+    while (suffix > 0 && ((unsigned char)next_text[length - suffix] & 0xC0) == 0x80) {
+        suffix--;
+    }
+
+    int old_end = old_length - suffix;
+    int new_end = length - suffix;
+
+    if (prefix < old_end || prefix < new_end) {
+        int prefix_col = columns(next_text, 0, prefix);
+        int old_cols = columns(screen.text, prefix, old_end);
+        int new_cols = columns(next_text, prefix, new_end);
+
+        move_cursor(screen.cursor, prefix_col);
+        if (suffix == 0) {
+            write_span(next_text, next_attrs, prefix, new_end);
+            if (old_cols > new_cols) frame_puts(CLEAR_TO_EOL);
+        } else if (new_cols > old_cols) {
+            frame_printf(INSERT_CHARS, new_cols - old_cols);
+            write_span(next_text, next_attrs, prefix, new_end);
+        } else {
+            write_span(next_text, next_attrs, prefix, new_end);
+            if (old_cols > new_cols) frame_printf(DELETE_CHARS, old_cols - new_cols);
+        }
+        screen.cursor = prefix_col + new_cols;
+    }
+
+    move_cursor(screen.cursor, point_col);
+    save_model(prompt, length, point_col);
+}
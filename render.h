@@ -0,0 +1,25 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+// Differential line renderer.
+// Keeps a model of the prompt row as it is on screen and only sends
+// what changed: relative cursor moves, inserted or deleted cells, and
+// repainted spans whose text or color differs.
+
+typedef struct {
+    int start;          // Byte range in the line
+    int end;
+    const char *color;  // SGR sequence, NULL for the default color
+} RenderSpan;
+
+// The text is given as two pieces (a gap buffer's halves) that are
+// drawn as one
+void render_line(const char *prompt, const char *before, int before_len,
+                 const char *after, int after_len, int point,
+                 const RenderSpan *spans, int span_count);
+
+// Forget the model, e.g. after printing something else; the next
+// render_line() repaints the whole row from the start of the line
+void render_invalidate(void);
+
+#endif
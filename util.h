@@ -0,0 +1,22 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Small helpers shared by the modules that keep files on disk
+
+// Rounds up to a multiple of 8, which keeps records in mapped files aligned
+size_t align8(size_t n);
+
+// FNV-1a; the command cache and history files store these hashes
+uint32_t hash_bytes(const char *s, size_t len);
+
+// Creates every missing directory above the last '/' of path
+void mkdir_parents(char *path);
+
+// write() until all of data is out, or an error other than EINTR
+bool write_all(int fd, const void *data, size_t len);
+
+#endif